@@ -26,6 +26,12 @@
 // HcBin objects represent Hillcrest Binary files.  This interface
 // definition is intended to represent such files in a way that
 // supports compression and/or streaming data via a serial interface.
+//
+// getAppDataPtr is optional and may be NULL.  Implementations that hold
+// the whole image in addressable memory can use it to return a pointer to
+// len bytes at offset, letting the DFU code read them in place instead of
+// copying them out with getAppData.  It may also return NULL for any
+// request it can't serve directly, in which case getAppData is used.
 
 typedef struct HcBin_s {
 	int (*open)(void);
@@ -34,6 +40,7 @@ typedef struct HcBin_s {
 	uint32_t (*getAppLen)(void);
 	uint32_t (*getPacketLen)(void);
 	int (*getAppData)(uint8_t *packet, uint32_t offset, uint32_t len);
+	const uint8_t * (*getAppDataPtr)(uint32_t offset, uint32_t len);
 } HcBin_t;
 
 #endif
@@ -0,0 +1,264 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Host-only: needs open() and mmap()
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HcBinFile.h"
+
+// .hcbin header (all fields 32-bit big endian)
+#define HCBIN_ID (0x6572d028)
+#define HCBIN_FF_VER (4)
+#define HCBIN_HEADER_LEN (16)
+#define HCBIN_CRC_LEN (4)
+
+// Space for the metadata section and the number of entries parsed from it
+#ifndef HCBINFILE_META_LEN
+#define HCBINFILE_META_LEN (1024)
+#endif
+#ifndef HCBINFILE_MAX_META
+#define HCBINFILE_MAX_META (32)
+#endif
+
+// --- Private Types -----------------------------------------------------------
+
+typedef struct HcBinMeta_s {
+	const char *key;
+	const char *value;
+} HcBinMeta_t;
+
+// --- Forward Declarations ----------------------------------------------------
+
+static int hcbinfile_open(void);
+static int hcbinfile_close(void);
+static const char * hcbinfile_getMeta(const char * key);
+static uint32_t hcbinfile_getAppLen(void);
+static uint32_t hcbinfile_getPacketLen(void);
+static int hcbinfile_getAppData(uint8_t *packet, uint32_t offset, uint32_t len);
+static const uint8_t * hcbinfile_getAppDataPtr(uint32_t offset, uint32_t len);
+
+static uint32_t read32be(const uint8_t *buf);
+static uint32_t crc32(const uint8_t *data, size_t len);
+static int parseMetadata(const uint8_t *data, size_t len);
+
+// --- Private Data ------------------------------------------------------------
+
+static const HcBin_t hcbinFile = {
+	hcbinfile_open,
+	hcbinfile_close,
+	hcbinfile_getMeta,
+	hcbinfile_getAppLen,
+	hcbinfile_getPacketLen,
+	hcbinfile_getAppData,
+	hcbinfile_getAppDataPtr,
+};
+
+static const char *filePath;
+
+// The mapping and the firmware image within it
+static const uint8_t *map;
+static size_t mapLen;
+static const uint8_t *appData;
+static uint32_t appLen;
+
+static char metaBuf[HCBINFILE_META_LEN];
+static HcBinMeta_t meta[HCBINFILE_MAX_META];
+static unsigned numMeta;
+
+// --- Public API --------------------------------------------------------------
+
+const HcBin_t * hcbinfile_init(const char *path)
+{
+	if (path == 0) return 0;
+
+	filePath = path;
+	return &hcbinFile;
+}
+
+// --- Private methods ---------------------------------------------------------
+
+static int hcbinfile_open(void)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	if (filePath == 0) return -1;
+	if (map != 0) hcbinfile_close();
+
+	fd = open(filePath, O_RDONLY);
+	if (fd < 0) return -1;
+	if ((fstat(fd, &st) != 0) || (st.st_size < HCBIN_HEADER_LEN + HCBIN_CRC_LEN)) {
+		close(fd);
+		return -1;
+	}
+
+	p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return -1;
+	map = p;
+	mapLen = st.st_size;
+
+	// Check header fields
+	uint32_t id = read32be(map);
+	uint32_t sz = read32be(map + 4);
+	uint32_t ffVer = read32be(map + 8);
+	uint32_t payloadOffset = read32be(map + 12);
+	if ((id != HCBIN_ID) || (ffVer != HCBIN_FF_VER) ||
+	    (sz < HCBIN_HEADER_LEN + HCBIN_CRC_LEN) || (sz > mapLen) ||
+	    (payloadOffset < HCBIN_HEADER_LEN) ||
+	    (payloadOffset > sz - HCBIN_CRC_LEN)) {
+		hcbinfile_close();
+		return -1;
+	}
+
+	// CRC32 covers everything up to the CRC itself
+	if (crc32(map, sz - HCBIN_CRC_LEN) != read32be(map + sz - HCBIN_CRC_LEN)) {
+		hcbinfile_close();
+		return -1;
+	}
+
+	if (parseMetadata(map + HCBIN_HEADER_LEN, payloadOffset - HCBIN_HEADER_LEN) != 0) {
+		hcbinfile_close();
+		return -1;
+	}
+
+	appData = map + payloadOffset;
+	appLen = sz - payloadOffset - HCBIN_CRC_LEN;
+
+	// DFU reads the image front to back, once
+	posix_madvise((void *)map, mapLen, POSIX_MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+static int hcbinfile_close(void)
+{
+	if (map != 0) {
+		munmap((void *)map, mapLen);
+	}
+	map = 0;
+	mapLen = 0;
+	appData = 0;
+	appLen = 0;
+	numMeta = 0;
+
+	return 0;
+}
+
+static const char * hcbinfile_getMeta(const char * key)
+{
+	for (unsigned i = 0; i < numMeta; i++) {
+		if (strcmp(key, meta[i].key) == 0) {
+			return meta[i].value;
+		}
+	}
+
+	// Not found
+	return 0;
+}
+
+static uint32_t hcbinfile_getAppLen(void)
+{
+	return appLen;
+}
+
+static uint32_t hcbinfile_getPacketLen(void)
+{
+	// No preferred packet len
+	return 0;
+}
+
+static int hcbinfile_getAppData(uint8_t *packet, uint32_t offset, uint32_t len)
+{
+	const uint8_t *src = hcbinfile_getAppDataPtr(offset, len);
+
+	if (src == 0) return -1;
+
+	memcpy(packet, src, len);
+	return 0;
+}
+
+static const uint8_t * hcbinfile_getAppDataPtr(uint32_t offset, uint32_t len)
+{
+	if ((appData == 0) || (offset > appLen) || (len > appLen - offset)) {
+		// requested data beyond the end
+		return 0;
+	}
+
+	return appData + offset;
+}
+
+static uint32_t read32be(const uint8_t *buf)
+{
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+	       ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+// CRC-32 as used by zlib (reflected, polynomial 0xEDB88320)
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (size_t n = 0; n < len; n++) {
+		crc ^= data[n];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+// Split the metadata section into "Key: Value" lines.  Lines are separated
+// by any run of CR, LF and NUL characters.
+static int parseMetadata(const uint8_t *data, size_t len)
+{
+	char *line;
+
+	if (len >= sizeof(metaBuf)) return -1;
+
+	memcpy(metaBuf, data, len);
+	metaBuf[len] = 0;
+	for (size_t n = 0; n < len; n++) {
+		if ((metaBuf[n] == '\r') || (metaBuf[n] == '\n')) metaBuf[n] = 0;
+	}
+
+	numMeta = 0;
+	line = metaBuf;
+	while (line < metaBuf + len) {
+		size_t lineLen = strlen(line);
+		char *sep = strstr(line, ": ");
+
+		if ((sep != 0) && (numMeta < HCBINFILE_MAX_META)) {
+			*sep = 0;
+			meta[numMeta].key = line;
+			meta[numMeta].value = sep + 2;
+			numMeta++;
+		}
+		line += lineLen + 1;
+	}
+
+	return 0;
+}
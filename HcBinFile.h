@@ -0,0 +1,55 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file HcBinFile.h
+ * @brief HcBin_t object backed by a .hcbin file (POSIX hosts).
+ *
+ * HcBinFile.c reads firmware for bno070_performDfu() straight from a
+ * Hillcrest .hcbin file instead of a C array generated by hcbin2c.py.
+ * The file is memory mapped when the HcBin_t object is opened; its header
+ * and CRC32 are checked and its metadata parsed once, and firmware data is
+ * then served directly out of the mapping.
+ */
+
+#ifndef HCBIN_FILE_H
+#define HCBIN_FILE_H
+
+#include "HcBin.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Get an HcBin_t object for a .hcbin file.
+ *
+ * The file isn't accessed until the object's open() is called, which
+ * bno070_performDfu() does.  There is a single file object, so a later
+ * call replaces the path used by earlier ones.
+ *
+ * @param  path  Name of the .hcbin file.  Must stay valid while the object is in use.
+ * @return       The HcBin_t object, or NULL if path is NULL.
+ */
+const HcBin_t * hcbinfile_init(const char *path);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+#endif
@@ -29,15 +29,143 @@
 
 #define SH_TIMEOUT_MS (10)
 
+// Alignment of each part of an sh_open() arena
+#define ARENA_ALIGN (8)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+#if (SH_EVENT_RING_LEN == 0) || ((SH_EVENT_RING_LEN & (SH_EVENT_RING_LEN - 1)) != 0)
+#error SH_EVENT_RING_LEN must be a power of 2
+#endif
+
+#if SH_FRS_WRITE_WINDOW < 1
+#error SH_FRS_WRITE_WINDOW must be at least 1
+#endif
+
+#if (SH_MAX_COMMANDS < 1) || (SH_MAX_COMMANDS > 128)
+#error SH_MAX_COMMANDS must be between 1 and 128
+#endif
+
+// Statements only compiled in with SH_DRIVER_STATS
+#if SH_DRIVER_STATS
+#define STATS(stmt) stmt
+#else
+#define STATS(stmt)
+#endif
+
+// Serialize use of a hub between threads, when the platform provides a lock
+#if SHDEV_LOCK
+#define LOCK(pHub) shdev_lock((pHub)->dev)
+#define UNLOCK(pHub) shdev_unlock((pHub)->dev)
+#else
+#define LOCK(pHub)
+#define UNLOCK(pHub)
+#endif
+
+// Orders ring slot accesses against index updates when producer and consumer
+// run on different cores.  A compiler barrier is enough on single-core MCUs.
+#ifndef SH_MEMORY_BARRIER
+#if defined(__GNUC__)
+#define SH_MEMORY_BARRIER() __sync_synchronize()
+#else
+#error Define SH_MEMORY_BARRIER() for this compiler (at least a compiler barrier)
+#endif
+#endif
+
+// Event ring index accesses shared by producer and consumer.  A release store
+// publishes the slot accesses before it to an acquire load of the index.
+#ifndef SH_LOAD_ACQUIRE
+#if defined(__GNUC__)
+#define SH_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SH_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#error Define SH_LOAD_ACQUIRE() and SH_STORE_RELEASE() for this compiler
+#endif
+#endif
+
 // --- Private Data Types -------------------------------------------------
 
+typedef enum sh_CommandState_e {
+	SH_CMD_IDLE,      // Slot free
+	SH_CMD_WAITING,   // Request sent, collecting responses
+	SH_CMD_DONE,      // All responses in, result not yet delivered
+} sh_CommandState_t;
+
+// A command awaiting its responses.  Results are stored straight into
+// the caller's buffers as responses arrive.
+typedef struct sh_Command_s {
+	volatile sh_CommandState_t state;
+	uint8_t command;   // SH_CR_...
+	uint8_t cmdSeq;
+	uint16_t replies;
+	int status;
+	union {
+		sh_Counts_t *pCounts;
+		struct {
+			sh_ErrorRecord_t *pErrors;
+			uint16_t *numErrors;
+			uint16_t maxErrors;
+		} errors;
+	} out;
+	sh_CommandCallback_t *callback;  // 0 for synchronous calls
+	void *cookie;
+#if SH_COMMAND_TIMEOUT_MS
+	uint32_t deadline_us;            // shdev_getTime_us() limit for responses
+#endif
+} sh_Command_t;
+
+typedef struct sh_Subscriber_s {
+	sh_EventCallback_t *callback;  // 0: no subscriber
+	void *cookie;
+} sh_Subscriber_t;
+
 typedef struct sh_SensorHub_s {
 	unsigned unit;
 	void * hid;  // Pointer to hid layer
 	void * dev;  // Pointer to platform-specific stuff
 	uint8_t commandSeq;
+	sh_Command_t cmd[SH_MAX_COMMANDS];  // Outstanding commands, matched by cmdSeq
+
+	// Event dispatch by sh_service(), indexed by sensor id
+	sh_Subscriber_t subscriber[SH_MAX_SENSOR_ID+1];
+	uint32_t sensorFilter;   // Bit n clear: reports from sensor n are not decoded
+
+	// Sequence number tracking, indexed by sensor id
+	sh_DeliveryCounts_t delivery[SH_MAX_SENSOR_ID+1];
+	uint8_t lastSeq[SH_MAX_SENSOR_ID+1];
+	bool seqValid[SH_MAX_SENSOR_ID+1];
+	uint8_t missed[SH_MAX_SENSOR_ID+1];   // Gap before the last report read
+
+	// Sees every input report, e.g. to record it.  0: none.
+	sh_ReportCallback_t *reportTap;
+	void *reportTapCookie;
+
+	// Time base for event timestamps
+	uint64_t time_us;          // 64-bit time of last INTN [uS]
+	uint32_t lastTimestamp;    // shdev_getTimestamp_us() value at last INTN
+
+	// Decoded events, single producer/single consumer.
+	// Indices run freely and are masked on access.  Shared fields are
+	// accessed with SH_LOAD_ACQUIRE and SH_STORE_RELEASE.
+	sh_SensorEvent_t *ring;
+	uint16_t ringMask;       // ring length - 1
+	uint16_t ringHead;       // written by producer only
+	uint16_t ringTail;       // written by consumer only
+	uint32_t ringOverflows;  // written by producer only
+
+#if SH_METADATA_CACHE
+	// Sensor metadata, indexed by sensor id
+	sh_SensorMetadata_t metadata[SH_MAX_SENSOR_ID+1];
+	bool metadataValid[SH_MAX_SENSOR_ID+1];
+#endif
+
+#if SH_DRIVER_STATS
+	sh_DriverStats_t *stats;   // Held by the HID layer
+#endif
 } sh_SensorHub_t;
 
+// sensorFilter and sh_setSensorFilter() have a bit per sensor id
+typedef char sh_SensorFilterFits_t[(SH_MAX_SENSOR_ID < 32) ? 1 : -1];
+
 enum sh_MetadataRecordId {
 	SH_META_RAW_ACCELEROMETER            = 0xE301,
 	SH_META_ACCELEROMETER                = 0xE302,
@@ -73,18 +201,132 @@ typedef enum sh_MetadataRecordId sh_MetadataRecordId_t;
 
 // --- Forward Declarations -----------------------------------------------
 
-static int decodeEvent(sh_SensorEvent_t *event, sh_HidReport_t *report, uint16_t reportLen, uint32_t timestamp);
+static int decodeEvent(sh_SensorHub_t *pSensorHub, sh_SensorEvent_t *event, sh_HidReport_t *report, uint16_t reportLen, uint32_t timestamp);
+static bool queueEvent(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t reportLen, uint32_t timestamp);
+static int readResponse(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t *reportLen);
+static int readReport(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t *reportLen, uint16_t wait_ms, uint32_t *pTimestamp);
+static uint16_t waitUnlocked(sh_SensorHub_t *pSensorHub, uint16_t wait_ms);
+static int frsRead(sh_SensorHub_t *pSensorHub, uint16_t recordId, uint32_t *pData, uint16_t *dataLenWords);
+static int frsWrite(sh_SensorHub_t *pSensorHub, uint16_t recordId, uint32_t *pData, uint16_t dataLen);
+static void noteReport(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t reportLen, uint32_t timestamp);
+static void trackSequence(sh_SensorHub_t *pSensorHub, uint8_t sensorId, uint8_t seq);
+static void resetHub(sh_SensorHub_t *pSensorHub, unsigned unit, sh_SensorEvent_t *ring, uint16_t ringLen);
+static void startHub(sh_SensorHub_t *pSensorHub);
+static int readMetadata(sh_SensorHub_t *pSensorHub, sh_SensorId_t sensorId, sh_SensorMetadata_t *pData);
+static void invalidateMetadata(sh_SensorHub_t *pSensorHub, uint16_t recordId);
+static sh_Command_t * newCommand(sh_SensorHub_t *pSensorHub, uint8_t command, sh_CommandCallback_t *callback, void *cookie);
+static int startCommand(sh_SensorHub_t *pSensorHub, sh_Command_t *pCmd, void *request, uint16_t requestLen);
+static void commandResponse(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t reportLen);
+static int waitCommand(sh_SensorHub_t *pSensorHub, uint8_t cmdSeq);
+static sh_Command_t * findCommand(sh_SensorHub_t *pSensorHub, uint8_t command, uint8_t cmdSeq);
+static void failCommands(sh_SensorHub_t *pSensorHub, int status, bool expiredOnly);
+static void hubReset(sh_SensorHub_t *pSensorHub);
+
+// Layout of a sensor's input report payload (the bytes after the 4 byte
+// header.)  Each field is unpacked into sh_SensorEvent_t.un at the same
+// offset it has in the report, so a layout is just the payload length and
+// which fields are 32 bits wide.
+typedef struct sh_SensorLayout_s {
+	uint8_t slots;  // Payload length in 16-bit units.  0: sensor not decoded.
+	uint8_t wide;   // Bit n set: a 32-bit field starts at slot n (n even.)
+} sh_SensorLayout_t;
+
+#define SLOTS16(n) { (n), 0x00 }  // n 16-bit integers
 
 // --- Private Data -------------------------------------------------------
 
-// sh_SensorHub_t objects to be returned via shdev_probe
+// Report layouts, indexed by sensor id.  Add new sensors here.
+static const sh_SensorLayout_t sensorLayout[SH_MAX_SENSOR_ID+1] = {
+	/* Reports that are 1 16-bit integer */
+	[SH_HUMIDITY]                    = SLOTS16(1),
+	[SH_PROXIMITY]                   = SLOTS16(1),
+	[SH_TEMPERATURE]                 = SLOTS16(1),
+	[SH_SIGNIFICANT_MOTION]          = SLOTS16(1),
+	[SH_SHAKE_DETECTOR]              = SLOTS16(1),
+	[SH_FLIP_DETECTOR]               = SLOTS16(1),
+	[SH_PICKUP_DETECTOR]             = SLOTS16(1),
+	[SH_STABILITY_DETECTOR]          = SLOTS16(1),
+
+	/* Reports that are 1 32-bit integer */
+	[SH_PRESSURE]                    = { 2, 0x01 },
+	[SH_AMBIENT_LIGHT]               = { 2, 0x01 },
+	[SH_STEP_DETECTOR]               = { 2, 0x01 },
+
+	/* 4 16-bit integers and a 32-bit timestamp */
+	[SH_RAW_ACCELEROMETER]           = { 6, 0x10 },
+	[SH_RAW_GYROSCOPE]               = { 6, 0x10 },
+	[SH_RAW_MAGNETOMETER]            = { 6, 0x10 },
+
+	/* Reports that are 3 16-bit integers */
+	[SH_ACCELEROMETER]               = SLOTS16(3),
+	[SH_LINEAR_ACCELERATION]         = SLOTS16(3),
+	[SH_GRAVITY]                     = SLOTS16(3),
+	[SH_GYROSCOPE_CALIBRATED]        = SLOTS16(3),
+	[SH_MAGNETIC_FIELD_CALIBRATED]   = SLOTS16(3),
+
+	/* Reports that are 4 16-bit integers */
+	[SH_GAME_ROTATION_VECTOR]        = SLOTS16(4),
+
+	/* Reports that are 5 16-bit integers */
+	[SH_ROTATION_VECTOR]             = SLOTS16(5),
+	[SH_GEOMAGNETIC_ROTATION_VECTOR] = SLOTS16(5),
+
+	/* Reports that are 6 16-bit integers */
+	[SH_GYROSCOPE_UNCALIBRATED]      = SLOTS16(6),
+	[SH_MAGNETIC_FIELD_UNCALIBRATED] = SLOTS16(6),
+
+	/* 32-bit detect latency, 16-bit steps, 16-bit reserved */
+	[SH_STEP_COUNTER]                = { 4, 0x01 },
+
+	/* TBD: SAR, tap detector and activity classification are left out,
+	 * so their reports fail to decode with SH_STATUS_BAD_REPORT. */
+};
+
+// Metadata FRS record for each sensor, indexed by sensor id.  0: none.
+static const uint16_t metadataRecord[SH_MAX_SENSOR_ID+1] = {
+	[SH_RAW_ACCELEROMETER]            = SH_META_RAW_ACCELEROMETER,
+	[SH_ACCELEROMETER]                = SH_META_ACCELEROMETER,
+	[SH_LINEAR_ACCELERATION]          = SH_META_LINEAR_ACCELERATION,
+	[SH_GRAVITY]                      = SH_META_GRAVITY,
+	[SH_RAW_GYROSCOPE]                = SH_META_RAW_GYROSCOPE,
+	[SH_GYROSCOPE_CALIBRATED]         = SH_META_GYROSCOPE_CALIBRATED,
+	[SH_GYROSCOPE_UNCALIBRATED]       = SH_META_GYROSCOPE_UNCALIBRATED,
+	[SH_RAW_MAGNETOMETER]             = SH_META_RAW_MAGNETOMETER,
+	[SH_MAGNETIC_FIELD_CALIBRATED]    = SH_META_MAGNETIC_FIELD_CALIBRATED,
+	[SH_MAGNETIC_FIELD_UNCALIBRATED]  = SH_META_MAGNETIC_FIELD_UNCALIBRATED,
+	[SH_ROTATION_VECTOR]              = SH_META_ROTATION_VECTOR,
+	[SH_GAME_ROTATION_VECTOR]         = SH_META_GAME_ROTATION_VECTOR,
+	[SH_GEOMAGNETIC_ROTATION_VECTOR]  = SH_META_GEOMAGNETIC_ROTATION_VECTOR,
+	[SH_PRESSURE]                     = SH_META_PRESSURE,
+	[SH_AMBIENT_LIGHT]                = SH_META_AMBIENT_LIGHT,
+	[SH_HUMIDITY]                     = SH_META_HUMIDITY,
+	[SH_PROXIMITY]                    = SH_META_PROXIMITY,
+	[SH_TEMPERATURE]                  = SH_META_TEMPERATURE,
+	[SH_TAP_DETECTOR]                 = SH_META_TAP_DETECTOR,
+	[SH_STEP_DETECTOR]                = SH_META_STEP_DETECTOR,
+	[SH_STEP_COUNTER]                 = SH_META_STEP_COUNTER,
+	[SH_SIGNIFICANT_MOTION]           = SH_META_SIGNIFICANT_MOTION,
+	[SH_ACTIVITY_CLASSIFICATION]      = SH_META_ACTIVITY_CLASSIFICATION,
+	[SH_SHAKE_DETECTOR]               = SH_META_SHAKE_DETECTOR,
+	[SH_FLIP_DETECTOR]                = SH_META_FLIP_DETECTOR,
+	[SH_PICKUP_DETECTOR]              = SH_META_PICKUP_DETECTOR,
+	[SH_STABILITY_DETECTOR]           = SH_META_STABILITY_DETECTOR,
+	[SH_PERSONAL_ACTIVITY_CLASSIFIER] = SH_META_PERSONAL_ACTIVITY_CLASSIFIER,
+	[SH_SLEEP_DETECTOR]               = SH_META_SLEEP_DETECTOR,
+};
+
+#if MAX_SH_UNITS > 0
+// sh_SensorHub_t objects to be returned via sh_init
 sh_SensorHub_t device[MAX_SH_UNITS];
+static sh_SensorEvent_t deviceRing[MAX_SH_UNITS][SH_EVENT_RING_LEN];
+#endif
 
 // --- Public API ---------------------------------------------------------
 
 // sh_init
 void * sh_init(unsigned unit)
 {
+#if MAX_SH_UNITS > 0
 	// Validate unit
 	if (unit >= MAX_SH_UNITS) {
 		// no such unit
@@ -92,15 +334,68 @@ void * sh_init(unsigned unit)
 	}
   
 	// "Allocate" a SensorHub for this unit
-	sh_SensorHub_t *sh = 0;
-	sh = &device[unit];
+	sh_SensorHub_t *sh = &device[unit];
+	resetHub(sh, unit, deviceRing[unit], SH_EVENT_RING_LEN);
   
 	// Connect with the device-specific portion of the driver
 	sh->dev = shdev_init(unit);
   
 	// Connect with the HID layer
 	sh->hid = shhid_init(unit, sh->dev);
+	startHub(sh);
   
+	return sh;
+#else
+	// No static storage: use sh_open()
+	return 0;
+#endif
+}
+
+// sh_getDefaultConfig
+void sh_getDefaultConfig(sh_Config_t *config)
+{
+	config->unit = 0;
+	config->eventRingLen = SH_EVENT_RING_LEN;
+}
+
+// sh_getArenaSize
+size_t sh_getArenaSize(const sh_Config_t *config)
+{
+	uint16_t ringLen = config->eventRingLen;
+
+	if ((ringLen == 0) || ((ringLen & (ringLen - 1)) != 0)) return 0;
+
+	// The hub, then the HID layer, then the event ring
+	return ARENA_ROUND(sizeof(sh_SensorHub_t)) +
+		ARENA_ROUND(shhid_getSize()) +
+		(size_t)ringLen * sizeof(sh_SensorEvent_t);
+}
+
+// sh_open
+void * sh_open(const sh_Config_t *config, void *arena, size_t arenaLen)
+{
+	uint8_t *pMem = (uint8_t *)arena;
+	size_t size = sh_getArenaSize(config);
+
+	if ((size == 0) || (pMem == 0) || (arenaLen < size) ||
+	    (((uintptr_t)pMem & (ARENA_ALIGN - 1)) != 0)) {
+		return 0;
+	}
+
+	sh_SensorHub_t *sh = (sh_SensorHub_t *)pMem;
+	pMem += ARENA_ROUND(sizeof(sh_SensorHub_t));
+	void *hidMem = pMem;
+	pMem += ARENA_ROUND(shhid_getSize());
+	resetHub(sh, config->unit, (sh_SensorEvent_t *)pMem, config->eventRingLen);
+
+	// Connect with the device-specific portion of the driver
+	sh->dev = shdev_init(config->unit);
+	if (sh->dev == 0) return 0;
+
+	// Connect with the HID layer
+	sh->hid = shhid_open(hidMem, config->unit, sh->dev);
+	startHub(sh);
+
 	return sh;
 }
 
@@ -113,7 +408,9 @@ int sh_getSensorConfig(void *sh, sh_SensorId_t sensorId, sh_SensorConfig_t *conf
 	int status;
   
 	report.reportId = sensorId;
+	LOCK(pHub);
 	status = shhid_getFeatureReport(pHub->hid, &report, &reportLen);
+	UNLOCK(pHub);
 	if (status < 0) {
 		return status;
 	}
@@ -144,6 +441,7 @@ int sh_setSensorConfig(void *sh, sh_SensorId_t sensorId, sh_SensorConfig_t *conf
 {
 	sh_SensorHub_t *pHub = (sh_SensorHub_t *)sh;
 	sh_SensorConfigFeatureReport_t report;
+	int status;
 
 	report.reportId = sensorId;
 	report.flags = 
@@ -155,13 +453,26 @@ int sh_setSensorConfig(void *sh, sh_SensorId_t sensorId, sh_SensorConfig_t *conf
 	report.reserved1 = config->reserved1;
 	report.sensorSpecific = config->sensorSpecific;
 
-	return shhid_setFeatureReport(pHub->hid, (uint8_t *)&report, sizeof(report));
+	LOCK(pHub);
+	status = shhid_setFeatureReport(pHub->hid, (uint8_t *)&report, sizeof(report));
+	if (sensorId <= SH_MAX_SENSOR_ID) {
+		// The sensor may restart its sequence numbers
+		pHub->seqValid[sensorId] = false;
+	}
+	UNLOCK(pHub);
+
+	return status;
 }
 
 // sh_eventReady
 bool sh_eventReady(void *sh)
 {
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+
+	// Events read during other calls wait in the ring with INTN deasserted
+	if (SH_LOAD_ACQUIRE(&pSensorHub->ringTail) != SH_LOAD_ACQUIRE(&pSensorHub->ringHead)) {
+		return true;
+	}
 	
 	bool state = shdev_getIntn(pSensorHub->dev);
 
@@ -184,307 +495,367 @@ int sh_getEventTO(void *sh, uint16_t timeout_ms, sh_SensorEvent_t *pEvent)
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 	uint32_t timestamp;
 
-	rc = shhid_in(pSensorHub->hid, &inReport, &reportLen, timeout_ms, &timestamp);
-
-	if (rc != SH_STATUS_SUCCESS) {
-	  return rc;
+	// Events that arrived during other operations come first
+	if (sh_popEvent(sh, pEvent) == SH_STATUS_SUCCESS) {
+		return SH_STATUS_SUCCESS;
 	}
 
-	rc = decodeEvent(pEvent, &inReport, reportLen, timestamp);
+	timeout_ms = waitUnlocked(pSensorHub, timeout_ms);
+
+	LOCK(pSensorHub);
+	rc = readReport(pSensorHub, &inReport, &reportLen, timeout_ms, &timestamp);
+
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = decodeEvent(pSensorHub, pEvent, &inReport, reportLen, timestamp);
+	}
+	UNLOCK(pSensorHub);
   
 	return rc;
 }
 
-// sh_getMetadata
-int sh_getMetadata(void *sh, sh_SensorId_t sensorId, sh_SensorMetadata_t *pData)
+// sh_getEvents
+int sh_getEvents(void *sh, sh_SensorEvent_t *pEvents, uint16_t maxEvents, uint16_t timeout_ms)
 {
-	const static struct {
-		sh_SensorId_t sensorId;
-		sh_MetadataRecordId_t recordId;
-	} sensorToRecordMap[] = {
-		{ SH_RAW_ACCELEROMETER,            SH_META_RAW_ACCELEROMETER },
-		{ SH_ACCELEROMETER,                SH_META_ACCELEROMETER },
-		{ SH_LINEAR_ACCELERATION,          SH_META_LINEAR_ACCELERATION },
-		{ SH_GRAVITY,                      SH_META_GRAVITY },
-		{ SH_RAW_GYROSCOPE,                SH_META_RAW_GYROSCOPE },
-		{ SH_GYROSCOPE_CALIBRATED,         SH_META_GYROSCOPE_CALIBRATED },
-		{ SH_GYROSCOPE_UNCALIBRATED,       SH_META_GYROSCOPE_UNCALIBRATED },
-		{ SH_RAW_MAGNETOMETER,             SH_META_RAW_MAGNETOMETER },
-		{ SH_MAGNETIC_FIELD_CALIBRATED,    SH_META_MAGNETIC_FIELD_CALIBRATED },
-		{ SH_MAGNETIC_FIELD_UNCALIBRATED,  SH_META_MAGNETIC_FIELD_UNCALIBRATED },
-		{ SH_ROTATION_VECTOR,              SH_META_ROTATION_VECTOR },
-		{ SH_GAME_ROTATION_VECTOR,         SH_META_GAME_ROTATION_VECTOR },
-		{ SH_GEOMAGNETIC_ROTATION_VECTOR,  SH_META_GEOMAGNETIC_ROTATION_VECTOR },
-		{ SH_PRESSURE,                     SH_META_PRESSURE },
-		{ SH_AMBIENT_LIGHT,                SH_META_AMBIENT_LIGHT },
-		{ SH_HUMIDITY,                     SH_META_HUMIDITY },
-		{ SH_PROXIMITY,                    SH_META_PROXIMITY },
-		{ SH_TEMPERATURE,                  SH_META_TEMPERATURE },
-		{ SH_TAP_DETECTOR,                 SH_META_TAP_DETECTOR },
-		{ SH_STEP_DETECTOR,                SH_META_STEP_DETECTOR },
-		{ SH_STEP_COUNTER,                 SH_META_STEP_COUNTER },
-		{ SH_SIGNIFICANT_MOTION,           SH_META_SIGNIFICANT_MOTION },
-		{ SH_ACTIVITY_CLASSIFICATION,      SH_META_ACTIVITY_CLASSIFICATION },
-		{ SH_SHAKE_DETECTOR,               SH_META_SHAKE_DETECTOR },
-		{ SH_FLIP_DETECTOR,                SH_META_FLIP_DETECTOR },
-		{ SH_PICKUP_DETECTOR,              SH_META_PICKUP_DETECTOR },
-		{ SH_STABILITY_DETECTOR,           SH_META_STABILITY_DETECTOR },
-		{ SH_PERSONAL_ACTIVITY_CLASSIFIER, SH_META_PERSONAL_ACTIVITY_CLASSIFIER },
-		{ SH_SLEEP_DETECTOR,               SH_META_SLEEP_DETECTOR },
-	};
+	int rc = SH_STATUS_SUCCESS;
+	sh_HidReport_t inReport;
+	uint16_t reportLen;
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint32_t timestamp;
+	uint16_t events = 0;
+	uint16_t wait_ms = timeout_ms;
 
-	uint32_t frsData[MAX_FRS_WORDS];
-	uint16_t frsDataLen;
+	if ((pEvents == 0) && (maxEvents > 0)) return SH_STATUS_BAD_PARAM;
 
-	// pData must not be NULL!
-	if (pData == 0) return SH_STATUS_BAD_PARAM;
-  
-	// Convert sensorId to metadata recordId
-	int i;
-	for (i = 0; i < ARRAY_LEN(sensorToRecordMap); i++) {
-		if (sensorToRecordMap[i].sensorId == sensorId) {
-			break;
-		}
-	}
-	if (i >= ARRAY_LEN(sensorToRecordMap)) {
-		// no match was found
-		return SH_STATUS_BAD_PARAM;
+	// Events that arrived during other operations come first
+	while ((events < maxEvents) && (sh_popEvent(sh, &pEvents[events]) == SH_STATUS_SUCCESS)) {
+		events++;
 	}
-	uint16_t recordId = sensorToRecordMap[i].recordId;
-  
-	// Fetch the metadata
-	frsDataLen = ARRAY_LEN(frsData);
-	int rc = sh_getFrs(sh, recordId, frsData, &frsDataLen);
-	if (rc != 0) {
-		return rc;
+	if (events > 0) {
+		wait_ms = 0;
 	}
-  
-	// Populate the sensorMetadata structure with results
-	pData->meVersion        = (frsData[0] >> 0) & 0xFF;
-	pData->mhVersion        = (frsData[0] >> 8) & 0xFF;
-	pData->shVersion        = (frsData[0] >> 16) & 0xFF;
-	pData->range            = frsData[1];
-	pData->resolution       = frsData[2];
-	pData->power_mA         = (frsData[3] >> 0) & 0xFFFF;    // 16.10 forma = Xt
-	pData->revision         = (frsData[3] >> 16) & 0xFFFF;
-	pData->minPeriod_uS     = frsData[4];
-	pData->fifoMax          = (frsData[5] >> 0) & 0xFFFF;
-	pData->fifoReserved     = (frsData[5] >> 16) & 0xFFFF;
-	pData->batchBufferBytes = (frsData[6] >> 0) & 0xFFFF;;
-	pData->vendorIdLen      = (frsData[6] >> 16) & 0xFFFF;
-	strcpy(pData->vendorId, ""); // init with empty string in case vendorIdLen == 0
+	wait_ms = waitUnlocked(pSensorHub, wait_ms);
 
-	if (pData->vendorIdLen > ARRAY_LEN(pData->vendorId)) {
-		return SH_STATUS_BAD_PARAM;
-	}
-	if (pData->revision == 0) {
-		memcpy(pData->vendorId, (uint8_t *)&frsData[7], pData->vendorIdLen);
-	}
-	else if (pData->revision == 1) {
-		pData->qPoint1        = (frsData[7] >> 0) & 0xFFFF;
-		pData->qPoint2        = (frsData[7] >> 16) & 0xFFFF;
-		memcpy(pData->vendorId, (uint8_t *)&frsData[8], pData->vendorIdLen);
-	}
-	else if (pData->revision == 2) {
-		pData->qPoint1        = (frsData[7] >> 0) & 0xFFFF;
-		pData->qPoint2        = (frsData[7] >> 16) & 0xFFFF;
-		pData->sensorSpecificLen = (frsData[8] >> 0) & 0xFFFF;
-		if (pData->sensorSpecificLen > ARRAY_LEN(pData->sensorSpecific)) {
-			return SH_STATUS_BAD_PARAM;
+	LOCK(pSensorHub);
+	while (events < maxEvents) {
+		reportLen = sizeof(inReport);
+		rc = readReport(pSensorHub, &inReport, &reportLen, wait_ms, &timestamp);
+
+		// Stop when INTN deasserts
+		if (rc == SH_STATUS_NO_DATA) break;
+
+		if (rc != SH_STATUS_SUCCESS) {
+			// Return the events already read, the error will recur on the next call
+			UNLOCK(pSensorHub);
+			return (events > 0) ? events : rc;
+		}
+
+		// Only block for the first report
+		wait_ms = 0;
+
+		// Non-sensor reports are dropped, as with sh_getEvent()
+		if (decodeEvent(pSensorHub, &pEvents[events], &inReport, reportLen, timestamp) == SH_STATUS_SUCCESS) {
+			events++;
 		}
-		memcpy(pData->sensorSpecific, (uint8_t *)&frsData[9], pData->sensorSpecificLen);
-		int vendorIdOffset = 9 + ((pData->sensorSpecificLen+3)/4); // 9 + one word for every 4 bytes of SS data
-		memcpy(pData->vendorId, (uint8_t *)&frsData[vendorIdOffset],
-		       pData->vendorIdLen);
-	}
-	else {
-		// Unrecognized revision!
 	}
+	UNLOCK(pSensorHub);
 
-	return SH_STATUS_SUCCESS;
+	return events;
 }
 
-// sh_getFrs
-int sh_getFrs(void *sh, uint16_t recordId, uint32_t *pData, uint16_t *dataLenWords)
+// sh_serviceIntn
+int sh_serviceIntn(void *sh)
 {
 	int rc = SH_STATUS_SUCCESS;
-	sh_SensorHub_t * pSensorHub = (sh_SensorHub_t *)sh;
-	sh_FrsReadReq_t outReport;
 	sh_HidReport_t inReport;
-	sh_FrsReadResp_t * readResp;
 	uint16_t reportLen;
-	bool done = false;
-	uint8_t words;
-	uint8_t offset;
-	uint16_t lastCopied = 0;
-	uint8_t status;
-	uint16_t readLenWords;
-	uint16_t n = 0;
-
-	// store incoming dataLenWords, set outgoing to zero in case we return w/o setting data.
-	readLenWords = *dataLenWords;
-	*dataLenWords = 0;
-  
-	// Issue FRS read request
-	outReport.reportId = SH_FRS_READ_REQUEST;
-	outReport.reserved = 0;
-	outReport.offset = 0;
-	outReport.recordId = recordId;
-	outReport.readLenWords = readLenWords;
-  
-	shhid_setOutReport(pSensorHub->hid, &outReport, sizeof(outReport));
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint32_t timestamp;
+	int queued = 0;
 
-	// Collect FRS read responses
-	while (!done) {
-		// Get the next input report
+	// Bounded so an interrupt handler can't be held here indefinitely
+	LOCK(pSensorHub);
+	for (int n = 0; n <= pSensorHub->ringMask; n++) {
 		reportLen = sizeof(inReport);
+		rc = readReport(pSensorHub, &inReport, &reportLen, 0, &timestamp);
+		if (rc != SH_STATUS_SUCCESS) break;
 
-		rc = shhid_in(pSensorHub->hid, &inReport, &reportLen, SH_TIMEOUT_MS, 0);
+		if (queueEvent(pSensorHub, &inReport, reportLen, timestamp)) {
+			queued++;
+		}
+	}
+	UNLOCK(pSensorHub);
 
-		// if poll fails, we fail
-		if (rc != SH_STATUS_SUCCESS) return rc;
+	if ((rc != SH_STATUS_SUCCESS) && (rc != SH_STATUS_NO_DATA)) return rc;
 
-		// Ignore anything but FRS Read responses for the requested recordId
-		if (reportLen != sizeof(sh_FrsReadResp_t)) continue;
+	return queued;
+}
 
-		if (inReport.reportId != SH_FRS_READ_RESPONSE) continue;
-		
-		readResp = (sh_FrsReadResp_t *)&inReport;
-		if (readResp->recordId != recordId) continue;
+// sh_service
+int sh_service(void *sh)
+{
+	int rc = SH_STATUS_SUCCESS;
+	sh_HidReport_t inReport;
+	uint16_t reportLen;
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	sh_SensorEvent_t event;
+	uint32_t timestamp;
+	int events = 0;
 
-		// Check status
-		status = readResp->words_status & 0x0F;
-    
-		if (status == SH_FRS_READ_UNRECOGNIZED) return SH_STATUS_FRS_READ_UNRECOGNIZED_FRS;
-		if (status == SH_FRS_READ_BUSY) return SH_STATUS_FRS_READ_BUSY;
-		if (status == SH_FRS_READ_OUT_OF_RANGE) return SH_STATUS_FRS_READ_OFFSET_OUT_OF_RANGE;
-		if (status == SH_FRS_READ_DEVICE_ERROR) return SH_STATUS_FRS_READ_DEVICE_ERROR;
+	LOCK(pSensorHub);
 
-		if (status == SH_FRS_READ_EMPTY) {
-			*dataLenWords = 0;
-			return SH_STATUS_SUCCESS;
+	// Events read during other calls wait in the ring.  Hand those at
+	// the head of the ring to their subscribers, straight from the slot.
+	while (pSensorHub->ringTail != SH_LOAD_ACQUIRE(&pSensorHub->ringHead)) {
+		uint16_t tail = pSensorHub->ringTail;
+		sh_SensorEvent_t *pEvent = &pSensorHub->ring[tail & pSensorHub->ringMask];
+		sh_Subscriber_t *sub = &pSensorHub->subscriber[pEvent->sensor];
+		if (sub->callback == 0) break;
+
+		sub->callback(sh, sub->cookie, pEvent);
+		SH_STORE_RELEASE(&pSensorHub->ringTail, tail + 1);
+		events++;
+	}
+
+	// Bounded, as in sh_serviceIntn.  Each report's successor is requested
+	// before the report is handled, so with an asynchronous HAL the next
+	// transfer runs while this one is decoded and dispatched.
+	shhid_inStart(pSensorHub->hid);
+	for (int n = 0; n <= pSensorHub->ringMask; n++) {
+		reportLen = sizeof(inReport);
+		rc = shhid_inFinish(pSensorHub->hid, &inReport, &reportLen, &timestamp);
+		if ((rc == SH_STATUS_NO_DATA) || (rc == SH_STATUS_BUSY)) {
+			// Nothing more yet
+			rc = SH_STATUS_SUCCESS;
+			break;
 		}
-		
-		// Store this portion of FRS record
-		words = (readResp->words_status >> 4) & 0x0F;
-		offset = readResp->offset;
+		shhid_inStart(pSensorHub->hid);
+		if (rc == SH_STATUS_HUB_RESET) {
+			hubReset(pSensorHub);
+			continue;
+		}
+		if (rc != SH_STATUS_SUCCESS) break;
 
-		for (n = 0; n < words; n++) {
-			if (offset+n >= readLenWords) {
-				rc = SH_STATUS_FRS_READ_UNEXPECTED_LENGTH;
-			}
-			else {
-				lastCopied = offset+n;
-				pData[lastCopied] = readResp->dataWord[n];
+		noteReport(pSensorHub, &inReport, reportLen, timestamp);
+
+		if ((inReport.reportId <= SH_MAX_SENSOR_ID) &&
+		    (pSensorHub->subscriber[inReport.reportId].callback != 0)) {
+			// Subscribed: decode on the stack and dispatch
+			sh_Subscriber_t *sub = &pSensorHub->subscriber[inReport.reportId];
+			if (decodeEvent(pSensorHub, &event, &inReport, reportLen, timestamp) == SH_STATUS_SUCCESS) {
+				sub->callback(sh, sub->cookie, &event);
+				events++;
 			}
 		}
+		else if (queueEvent(pSensorHub, &inReport, reportLen, timestamp)) {
+			events++;
+		}
+	}
 
-		// Check for done condition
-		if ((status == SH_FRS_READ_RECORD_COMPLETED) ||
-		    (status == SH_FRS_READ_BLOCK_COMPLETED) ||
-		    (status == SH_FRS_READ_BOTH_COMPLETED)) {
-			done = true;
+#if SH_COMMAND_TIMEOUT_MS
+	// Give up on commands whose responses were lost
+	failCommands(pSensorHub, SH_STATUS_TIMEOUT, true);
+#endif
+
+	// Deliver completions.  The slot is freed first so the callback can submit again.
+	for (int n = 0; n < SH_MAX_COMMANDS; n++) {
+		sh_Command_t *pCmd = &pSensorHub->cmd[n];
+		if ((pCmd->state == SH_CMD_DONE) && (pCmd->callback != 0)) {
+			sh_CommandCallback_t *callback = pCmd->callback;
+			void *cookie = pCmd->cookie;
+			int status = pCmd->status;
+
+			pCmd->state = SH_CMD_IDLE;
+			callback(sh, cookie, status);
 		}
 	}
+	UNLOCK(pSensorHub);
 
-	// set dataLenWords to last offset copied + 1 for return
-	*dataLenWords = lastCopied+1;
-  
-	return rc;
+	return (rc == SH_STATUS_SUCCESS) ? events : rc;
 }
 
-// sh_setFrs
-int sh_setFrs(void *sh, uint16_t recordId, uint32_t *pData, uint16_t dataLen)
+// sh_subscribe
+int sh_subscribe(void *sh, sh_SensorId_t sensorId, sh_EventCallback_t *callback, void *cookie)
 {
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
-	sh_FrsWriteReq_t writeReq;
-	sh_FrsWriteDataReq_t writeDataReq;
-	sh_HidReport_t inReport;
-	sh_FrsWriteResp_t *writeResp;
-	uint16_t len;
-	uint16_t toWrite = dataLen;
-	uint16_t offset = 0;
-	int rc;
-	uint16_t status;
-  
-	// Issue FRS write request
-	writeReq.reportId = SH_FRS_WRITE_REQUEST;
-	writeReq.reserved = 0;
-	writeReq.dataLen = dataLen;
-	writeReq.recordId = recordId;
-	shhid_setOutReport(pSensorHub->hid, &writeReq, sizeof(writeReq));
 
-	while (true) {
-		// Get Write Response
-		len = sizeof(inReport);
-		rc = shhid_in(pSensorHub->hid, &inReport, &len, SH_TIMEOUT_MS, 0);
-		if (rc != 0) {
-			return rc;
-		}
+	if (sensorId > SH_MAX_SENSOR_ID) return SH_STATUS_BAD_PARAM;
 
-		// If this isn't a write response, ignore it
-		if (inReport.reportId != SH_FRS_WRITE_RESPONSE) {
-			continue;
-		}
-		if (len != sizeof(sh_FrsWriteResp_t)) {
-			continue;
-		}
+	// Clear the callback first so the pair never mixes old and new
+	LOCK(pSensorHub);
+	pSensorHub->subscriber[sensorId].callback = 0;
+	pSensorHub->subscriber[sensorId].cookie = cookie;
+	pSensorHub->subscriber[sensorId].callback = callback;
+	UNLOCK(pSensorHub);
 
-		writeResp = (sh_FrsWriteResp_t *)&inReport;
-		status = writeResp->status;
-    
-		// Check for errors
-		if (status == SH_FRS_WRITE_UNRECOGNIZED)
-			return SH_STATUS_FRS_WRITE_BAD_TYPE;
-		if (status == SH_FRS_WRITE_BUSY)
-			return SH_STATUS_FRS_WRITE_BUSY;
-		if (status == SH_FRS_WRITE_FAILED)
-			return SH_STATUS_FRS_WRITE_FAILED;
-		if (status == SH_FRS_WRITE_BAD_MODE)
-			return SH_STATUS_FRS_WRITE_BAD_MODE;
-		if (status == SH_FRS_WRITE_BAD_LEN)
-			return SH_STATUS_FRS_WRITE_BAD_LENGTH;
-		if (status == SH_FRS_WRITE_INVALID)
-			return SH_STATUS_FRS_WRITE_INVALID_RECORD;
-		if (status == SH_FRS_WRITE_DEVICE_ERR)
-			return SH_STATUS_FRS_WRITE_DEVICE_ERROR;
-		if (status == SH_FRS_WRITE_READ_ONLY)
-			return SH_STATUS_FRS_WRITE_READ_ONLY;
+	return SH_STATUS_SUCCESS;
+}
 
-		// Check for successful completion condition
-		if ((status == SH_FRS_WRITE_COMPLETED) &&
-		    (toWrite == 0)) {
-			return SH_STATUS_SUCCESS;
-		}
+// sh_setReportTap
+int sh_setReportTap(void *sh, sh_ReportCallback_t *callback, void *cookie)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 
-		// Check for SH ended before we were ready
-		if (status == SH_FRS_WRITE_COMPLETED)
-			return SH_STATUS_FRS_WRITE_NOT_ENOUGH;
+	LOCK(pSensorHub);
+	pSensorHub->reportTap = callback;
+	pSensorHub->reportTapCookie = cookie;
+	UNLOCK(pSensorHub);
 
-		if (toWrite > 0) {
-			// Write more data
-			writeDataReq.reportId = SH_FRS_WRITE_DATA_REQUEST;
-			writeDataReq.reserved = 0;
-			writeDataReq.wordOffset = offset;
+	return SH_STATUS_SUCCESS;
+}
 
-			// set data[0] field
-			writeDataReq.data[0] = pData[offset++];
-			toWrite -= 1;
-			if (toWrite > 0) {
-				// set data[1], too
-				writeDataReq.data[1] = pData[offset++];
-				toWrite -= 1;
-			}
+// sh_setSensorFilter
+int sh_setSensorFilter(void *sh, uint32_t sensorMask)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 
-			// Issue FRS write data request
-			rc = shhid_setOutReport(pSensorHub->hid, &writeDataReq, sizeof(writeDataReq));
-			if (rc != 0) {
-				return rc;
-			}
-		}
+	LOCK(pSensorHub);
+	pSensorHub->sensorFilter = sensorMask;
+	UNLOCK(pSensorHub);
+
+	return SH_STATUS_SUCCESS;
+}
+
+// sh_popEvent
+int sh_popEvent(void *sh, sh_SensorEvent_t *pEvent)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint16_t tail = pSensorHub->ringTail;
+
+	// Read the slot only after seeing the producer's index update
+	if (tail == SH_LOAD_ACQUIRE(&pSensorHub->ringHead)) {
+		return SH_STATUS_NO_DATA;
 	}
 
-	// should never get here.  return is from inside the loop
+	*pEvent = pSensorHub->ring[tail & pSensorHub->ringMask];
+
+	// Release the slot only after it has been copied out
+	SH_STORE_RELEASE(&pSensorHub->ringTail, tail + 1);
+
+	return SH_STATUS_SUCCESS;
+}
+
+// sh_getEventOverflows
+int sh_getEventOverflows(void *sh, uint32_t *pOverflows)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+
+	if (pOverflows == 0) return SH_STATUS_BAD_PARAM;
+
+	*pOverflows = SH_LOAD_ACQUIRE(&pSensorHub->ringOverflows);
+
+	return SH_STATUS_SUCCESS;
+}
+
+// sh_getDriverStats
+int sh_getDriverStats(void *sh, sh_DriverStats_t *pStats)
+{
+	if (pStats == 0) return SH_STATUS_BAD_PARAM;
+
+#if SH_DRIVER_STATS
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+
+	LOCK(pSensorHub);
+	*pStats = *pSensorHub->stats;
+	UNLOCK(pSensorHub);
+	return SH_STATUS_SUCCESS;
+#else
+	memset(pStats, 0, sizeof(*pStats));
+	return SH_STATUS_ERROR;
+#endif
+}
+
+// sh_clearDriverStats
+int sh_clearDriverStats(void *sh)
+{
+#if SH_DRIVER_STATS
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+
+	LOCK(pSensorHub);
+	memset(pSensorHub->stats, 0, sizeof(*pSensorHub->stats));
+	UNLOCK(pSensorHub);
+	return SH_STATUS_SUCCESS;
+#else
+	return SH_STATUS_ERROR;
+#endif
+}
+
+// sh_readTrace
+int sh_readTrace(void *sh, uint8_t *pBuf, unsigned maxRecords)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	int rc;
+
+	if ((pBuf == 0) && (maxRecords > 0)) return SH_STATUS_BAD_PARAM;
+
+	LOCK(pSensorHub);
+	rc = shhid_readTrace(pSensorHub->hid, pBuf, maxRecords);
+	UNLOCK(pSensorHub);
+
+	return rc;
+}
+
+// sh_getMetadata
+int sh_getMetadata(void *sh, sh_SensorId_t sensorId, sh_SensorMetadata_t *pData)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	int rc;
+
+	// pData must not be NULL!
+	if (pData == 0) return SH_STATUS_BAD_PARAM;
+
+	// Only sensors with a metadata record
+	if ((sensorId > SH_MAX_SENSOR_ID) || (metadataRecord[sensorId] == 0)) {
+		return SH_STATUS_BAD_PARAM;
+	}
+
+	LOCK(pSensorHub);
+
+#if SH_METADATA_CACHE
+	if (pSensorHub->metadataValid[sensorId]) {
+		*pData = pSensorHub->metadata[sensorId];
+		UNLOCK(pSensorHub);
+		return SH_STATUS_SUCCESS;
+	}
+#endif
+
+	rc = readMetadata(pSensorHub, sensorId, pData);
+
+#if SH_METADATA_CACHE
+	if (rc == SH_STATUS_SUCCESS) {
+		pSensorHub->metadata[sensorId] = *pData;
+		pSensorHub->metadataValid[sensorId] = true;
+	}
+#endif
+
+	UNLOCK(pSensorHub);
+
+	return rc;
+}
+
+// sh_getFrs
+int sh_getFrs(void *sh, uint16_t recordId, uint32_t *pData, uint16_t *dataLenWords)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	int rc;
+
+	LOCK(pSensorHub);
+	rc = frsRead(pSensorHub, recordId, pData, dataLenWords);
+	UNLOCK(pSensorHub);
+
+	return rc;
+}
+
+// sh_setFrs
+int sh_setFrs(void *sh, uint16_t recordId, uint32_t *pData, uint16_t dataLen)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	int rc;
+
+	LOCK(pSensorHub);
+	rc = frsWrite(pSensorHub, recordId, pData, dataLen);
+	UNLOCK(pSensorHub);
+
+	return rc;
 }
 
 // sh_getProdIds
@@ -497,6 +868,8 @@ int sh_getProdIds(void * sh, sh_ProductId_t prodId[SH_NUM_PRODUCT_IDS])
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
         int prodIds = 0;
 
+	LOCK(pSensorHub);
+
 	// Send Product ID Request
 	prodIdReq.reportId = SH_PRODUCT_ID_REQUEST;
 	prodIdReq.reserved = 0;
@@ -506,8 +879,7 @@ int sh_getProdIds(void * sh, sh_ProductId_t prodId[SH_NUM_PRODUCT_IDS])
 
 	// Read SH_NUM_PRODUCT_IDS Product ID Responses
 	while (prodIds < SH_NUM_PRODUCT_IDS) {
-		reportLen = sizeof(inReport);
-		rc = shhid_in(pSensorHub->hid, &inReport, &reportLen, SH_TIMEOUT_MS, 0);
+		rc = readResponse(pSensorHub, &inReport, &reportLen);
 
 		if (rc != SH_STATUS_SUCCESS) 
 			goto exit;
@@ -528,152 +900,191 @@ int sh_getProdIds(void * sh, sh_ProductId_t prodId[SH_NUM_PRODUCT_IDS])
 	}
 
 exit:
+	UNLOCK(pSensorHub);
+
 	// return status
 	return rc;
 }
 
 // sh_getErrors
 int sh_getErrors(void *sh, uint8_t severity, sh_ErrorRecord_t *pErrors, uint16_t *numErrors)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint8_t thisSeq;
+	int rc;
+
+	LOCK(pSensorHub);
+	thisSeq = pSensorHub->commandSeq;  // sequence number the request will use
+	rc = sh_getErrorsAsync(sh, severity, pErrors, numErrors, 0, 0);
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = waitCommand(pSensorHub, thisSeq);
+	}
+	UNLOCK(pSensorHub);
+
+	return rc;
+}
+
+// sh_getErrorsAsync
+int sh_getErrorsAsync(void *sh, uint8_t severity, sh_ErrorRecord_t *pErrors, uint16_t *numErrors,
+                      sh_CommandCallback_t *callback, void *cookie)
 {
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 	sh_GetErrsReq_t request;
-	sh_HidReport_t inReport;
+	sh_Command_t *pCmd;
 	int rc;
-	uint16_t reportLen;
+
+	if (numErrors == 0) return SH_STATUS_BAD_PARAM;
+	if ((pErrors == 0) && (*numErrors > 0)) return SH_STATUS_BAD_PARAM;
+
+	LOCK(pSensorHub);
+	pCmd = newCommand(pSensorHub, SH_CR_REPORT_ERRORS, callback, cookie);
+	if (pCmd == 0) {
+		UNLOCK(pSensorHub);
+		return SH_STATUS_BUSY;
+	}
+	pCmd->out.errors.pErrors = pErrors;
+	pCmd->out.errors.numErrors = numErrors;
+	pCmd->out.errors.maxErrors = *numErrors;
 
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
-	// get command sequence number for this command
-	uint8_t thisSeq = pSensorHub->commandSeq++;
-
-	// format a request to get counts
+	// format a request to get errors
 	request.reportId = SH_COMMAND_REQUEST;
-	request.sequence = thisSeq;
+	request.sequence = pCmd->cmdSeq;
 	request.command = SH_CR_REPORT_ERRORS;
 	request.severity = severity;
 
-	// send the request
-	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
-	if (rc != 0) return rc;
-
-	int replies = 0;
-	bool finished = false;
-	while (!finished) {
-		// get reply
-		reportLen = sizeof(inReport);
-		rc = shhid_in(pSensorHub->hid, &inReport, &reportLen, SH_TIMEOUT_MS, 0);
-		if (rc != 0) return rc;
-
-		// ignore if not the right reportId
-		if ((reportLen != sizeof(sh_CommandResp_t)) ||
-		    (inReport.reportId != SH_COMMAND_RESPONSE)) {
-			continue;
-		}
+	rc = startCommand(pSensorHub, pCmd, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 
-		// ignore if not the response for the command we just sent
-		sh_CommandResp_t * cmdResp = (sh_CommandResp_t *)&inReport;
-		if ((cmdResp->command != SH_CR_REPORT_ERRORS) ||
-		    (cmdResp->cmdSeq != thisSeq)) {
-			continue;
-		}
+	return rc;
+}
 
-		sh_GetErrsResp_t * errResp = (sh_GetErrsResp_t *)&inReport;
+// sh_getCounts
+int sh_getCounts(void *sh, sh_SensorId_t sensorId, sh_Counts_t *pCounts)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint8_t thisSeq;
+	int rc;
 
-		// detect end of response sequence
-                // Version 1.2.5 uses severity == 255 to denote no errors
-                // Version 1.8.x uses source == 255.
-		if ((errResp->source == 255) || (errResp->severity == 255)){
-			finished = true;
-		}
-		else {
-			// store content if we still have room
-			if (replies < *numErrors) {
-				pErrors[replies].severity = errResp->severity;
-				pErrors[replies].sequence = errResp->errSeq;
-				pErrors[replies].source   = errResp->source;
-				pErrors[replies].error    = errResp->error;
-				pErrors[replies].module   = errResp->module;
-				pErrors[replies].code     = errResp->code;
-
-				// increment replies seen
-				replies++;
-			}
-		}
+	LOCK(pSensorHub);
+	thisSeq = pSensorHub->commandSeq;  // sequence number the request will use
+	rc = sh_getCountsAsync(sh, sensorId, pCounts, 0, 0);
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = waitCommand(pSensorHub, thisSeq);
 	}
+	UNLOCK(pSensorHub);
 
-	*numErrors = replies;
-
-	return 0;
+	return rc;
 }
 
-// sh_getCounts
-int sh_getCounts(void *sh, sh_SensorId_t sensorId, sh_Counts_t *pCounts)
+// sh_getCountsAsync
+int sh_getCountsAsync(void *sh, sh_SensorId_t sensorId, sh_Counts_t *pCounts,
+                      sh_CommandCallback_t *callback, void *cookie)
 {
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 	sh_CountsReq_t request;
-	sh_HidReport_t response;
-	
+	sh_Command_t *pCmd;
 	int rc;
-	uint16_t reportLen;
+
+	if (pCounts == 0) return SH_STATUS_BAD_PARAM;
+
+	LOCK(pSensorHub);
+	pCmd = newCommand(pSensorHub, SH_CR_COUNTS, callback, cookie);
+	if (pCmd == 0) {
+		UNLOCK(pSensorHub);
+		return SH_STATUS_BUSY;
+	}
+	pCmd->out.pCounts = pCounts;
 
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
-	uint8_t thisSeq = pSensorHub->commandSeq++;
-
 	// format a request to get counts
 	request.reportId   = SH_COMMAND_REQUEST;
-	request.sequence   = thisSeq;
+	request.sequence   = pCmd->cmdSeq;
 	request.command    = SH_CR_COUNTS;
 	request.subCommand = SH_CR_COUNTS_GET;
 	request.sensorId   = sensorId;
 
-	// send the request
-	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
-	if (rc != 0) return rc;
+	rc = startCommand(pSensorHub, pCmd, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 
-	int replies = 0;
-	while (replies < 2) {
-		// get reply
-		reportLen = sizeof(response);
-		rc = shhid_in(pSensorHub->hid, &response, &reportLen, SH_TIMEOUT_MS, 0);
-		if (rc != 0) return rc;
+	return rc;
+}
 
-		// ignore if not the right message
-		if ((reportLen != sizeof(sh_CommandResp_t)) ||
-		    (response.reportId != SH_COMMAND_RESPONSE)) {
-			continue;
-		}
+// sh_getDeliveryCounts
+int sh_getDeliveryCounts(void *sh, sh_SensorId_t sensorId, sh_DeliveryCounts_t *pCounts)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 
-		sh_CommandResp_t *cmdResp = (sh_CommandResp_t *)&response;
+	if ((sensorId > SH_MAX_SENSOR_ID) || (pCounts == 0)) return SH_STATUS_BAD_PARAM;
 
-		// ignore if not the response to this command
-		if ((cmdResp->command != SH_CR_COUNTS) ||
-		    (cmdResp->cmdSeq != thisSeq)) {
-			continue;
-		}
+	LOCK(pSensorHub);
+	*pCounts = pSensorHub->delivery[sensorId];
+	UNLOCK(pSensorHub);
 
-		sh_GetCountsResp_t * counts = (sh_GetCountsResp_t *)&response;
+	return SH_STATUS_SUCCESS;
+}
 
-		// Check for bad status
-		if (counts->status != 1) return SH_STATUS_SH_ERR;
+// sh_clearDeliveryCounts
+int sh_clearDeliveryCounts(void *sh)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 
-		// store content, based on response seq num
-		if (counts->respSeq == 0) {
-			pCounts->offered = counts->value[0];
-			pCounts->accepted = counts->value[1];
-		}
-		else if (counts->respSeq == 1) {
-			pCounts->on = counts->value[0];
-			pCounts->attempted = counts->value[1];
+	// Sequence tracking carries on, so the next report isn't seen as a gap
+	LOCK(pSensorHub);
+	memset(pSensorHub->delivery, 0, sizeof(pSensorHub->delivery));
+	UNLOCK(pSensorHub);
+
+	return SH_STATUS_SUCCESS;
+}
+
+// sh_getCountsMulti
+int sh_getCountsMulti(void *sh, const sh_SensorId_t *sensorIds, uint16_t numSensors, sh_Counts_t *pCounts)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint8_t seq[SH_MAX_COMMANDS];   // Outstanding requests, oldest first
+	uint16_t sent = 0;
+	uint16_t done = 0;
+	int result = SH_STATUS_SUCCESS;
+	int rc;
+
+	if ((numSensors > 0) && ((sensorIds == 0) || (pCounts == 0))) return SH_STATUS_BAD_PARAM;
+
+	LOCK(pSensorHub);
+	while (done < numSensors) {
+		// Keep as many requests outstanding as there are free slots
+		while (sent < numSensors) {
+			uint8_t thisSeq = pSensorHub->commandSeq;
+			rc = sh_getCountsAsync(sh, sensorIds[sent], &pCounts[sent], 0, 0);
+			if (rc == SH_STATUS_BUSY) break;
+			if (rc != SH_STATUS_SUCCESS) {
+				// Collect what is already outstanding, then stop
+				if (result == SH_STATUS_SUCCESS) result = rc;
+				numSensors = sent;
+				break;
+			}
+			seq[sent % SH_MAX_COMMANDS] = thisSeq;
+			sent++;
 		}
 
-		// increment replies seen
-		replies++;
+		// Nothing could be sent (slots held by asynchronous callers)
+		if (done == sent) break;
+
+		// Responses arrive in request order
+		rc = waitCommand(pSensorHub, seq[done % SH_MAX_COMMANDS]);
+		if ((rc != SH_STATUS_SUCCESS) && (result == SH_STATUS_SUCCESS)) result = rc;
+		done++;
 	}
 
-	return 0;
+	if ((done < numSensors) && (result == SH_STATUS_SUCCESS)) {
+		result = SH_STATUS_BUSY;
+	}
+	UNLOCK(pSensorHub);
+
+	return result;
 }
 
 // sh_clearCounts
@@ -686,6 +1097,7 @@ int sh_clearCounts(void *sh, sh_SensorId_t sensorId)
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
+	LOCK(pSensorHub);
 	uint8_t thisSeq = pSensorHub->commandSeq++;
 
 	// format a request to clear counts
@@ -697,6 +1109,7 @@ int sh_clearCounts(void *sh, sh_SensorId_t sensorId)
 
 	// send the request
 	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 	if (rc != 0) return rc;
 
 	return 0;
@@ -712,6 +1125,7 @@ int sh_tareNow(void *sh, uint8_t axes, sh_TareBasis_t basis)
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
+	LOCK(pSensorHub);
 	uint8_t thisSeq = pSensorHub->commandSeq++;
 
 	// format the tare now command
@@ -724,6 +1138,7 @@ int sh_tareNow(void *sh, uint8_t axes, sh_TareBasis_t basis)
 
 	// send the request
 	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 	if (rc != 0) return rc;
 
 	return 0;
@@ -739,6 +1154,7 @@ int sh_tareClear(void *sh)
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
+	LOCK(pSensorHub);
 	uint8_t thisSeq = pSensorHub->commandSeq++;
 
 	// format the tare set-orientation command
@@ -753,6 +1169,7 @@ int sh_tareClear(void *sh)
 
 	// send the request
 	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 	if (rc != 0) return rc;
 
 	return 0;
@@ -768,6 +1185,7 @@ int sh_persistTare(void *sh)
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
+	LOCK(pSensorHub);
 	uint8_t thisSeq = pSensorHub->commandSeq++;
 
 	// format the tare persist-tare command
@@ -778,6 +1196,7 @@ int sh_persistTare(void *sh)
 
 	// send the request
 	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 	if (rc != 0) return rc;
 
 	return 0;
@@ -793,6 +1212,7 @@ int sh_setReorientation(void *sh, sh_Quaternion_t *orientation)
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
+	LOCK(pSensorHub);
 	uint8_t thisSeq = pSensorHub->commandSeq++;
 
 	// format the tare set-orientation command
@@ -807,6 +1227,7 @@ int sh_setReorientation(void *sh, sh_Quaternion_t *orientation)
 
 	// send the request
 	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 	if (rc != 0) return rc;
 
 	return 0;
@@ -819,6 +1240,7 @@ int sh_reinitialize(void *sh)
 	sh_ReinitializeReq_t request;
 	int rc;
   
+	LOCK(pSensorHub);
 	uint8_t thisSeq = pSensorHub->commandSeq++;
 
 	// zero the report before sending
@@ -832,6 +1254,7 @@ int sh_reinitialize(void *sh)
 
 	// send the request
 	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 	if (rc != 0) return rc;
 
 	return 0;
@@ -839,116 +1262,100 @@ int sh_reinitialize(void *sh)
 
 // sh_dcdSaveNow
 int sh_dcdSaveNow(void *sh)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint8_t thisSeq;
+	int rc;
+
+	LOCK(pSensorHub);
+	thisSeq = pSensorHub->commandSeq;  // sequence number the request will use
+	rc = sh_dcdSaveNowAsync(sh, 0, 0);
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = waitCommand(pSensorHub, thisSeq);
+	}
+	UNLOCK(pSensorHub);
+
+	return rc;
+}
+
+// sh_dcdSaveNowAsync
+int sh_dcdSaveNowAsync(void *sh, sh_CommandCallback_t *callback, void *cookie)
 {
 	// command : SH_CR_SAVE_DCD
 	// response : single message, [5] contains status, 0 on success
 
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 	sh_DcdSaveNowReq_t request;
-	sh_HidReport_t response;
+	sh_Command_t *pCmd;
 	int rc;
-	uint16_t reportLen;
+
+	LOCK(pSensorHub);
+	pCmd = newCommand(pSensorHub, SH_CR_SAVE_DCD, callback, cookie);
+	if (pCmd == 0) {
+		UNLOCK(pSensorHub);
+		return SH_STATUS_BUSY;
+	}
 
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
-	uint8_t thisSeq = pSensorHub->commandSeq++;
-
-	// format a request to get counts
+	// format a request to save DCD
 	request.reportId = SH_COMMAND_REQUEST;
-	request.sequence = thisSeq;
+	request.sequence = pCmd->cmdSeq;
 	request.command = SH_CR_SAVE_DCD;
 
-	// send the request
-	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
-	if (rc != 0) return rc;
-
-	int replies = 0;
-	while (replies < 1) {
-		// get reply
-		reportLen = sizeof(response);
-		rc = shhid_in(pSensorHub->hid, &response, &reportLen, SH_TIMEOUT_MS, 0);
-		if (rc != 0) return rc;
-
-		// ignore if not the right message
-		if ((reportLen != sizeof(sh_CommandResp_t)) ||
-		    (response.reportId != SH_COMMAND_RESPONSE)) {
-			continue;
-		}
-
-		sh_CommandResp_t *cmdResp = (sh_CommandResp_t *)&response;
+	rc = startCommand(pSensorHub, pCmd, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 
-		// ignore if not the response to this command
-		if ((cmdResp->command != SH_CR_SAVE_DCD) ||
-		    (cmdResp->cmdSeq != thisSeq)) {
-			continue;
-		}
+	return rc;
+}
 
-		sh_DcdSaveNowResp_t * dcdSaveResp = (sh_DcdSaveNowResp_t *)&response;
-		
-		// copy status to rc for return
-		rc = dcdSaveResp->status;
+// sh_calConfig
+int sh_calConfig(void *sh, uint8_t sensors)
+{
+	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
+	uint8_t thisSeq;
+	int rc;
 
-		replies++;
+	LOCK(pSensorHub);
+	thisSeq = pSensorHub->commandSeq;  // sequence number the request will use
+	rc = sh_calConfigAsync(sh, sensors, 0, 0);
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = waitCommand(pSensorHub, thisSeq);
 	}
+	UNLOCK(pSensorHub);
 
 	return rc;
 }
 
-// sh_calConfig
-int sh_calConfig(void *sh, uint8_t sensors)
+// sh_calConfigAsync
+int sh_calConfigAsync(void *sh, uint8_t sensors, sh_CommandCallback_t *callback, void *cookie)
 {
 	sh_SensorHub_t *pSensorHub = (sh_SensorHub_t *)sh;
 	sh_CalConfigReq_t request;
-	sh_HidReport_t response;
+	sh_Command_t *pCmd;
 	int rc;
-	uint16_t reportLen;
+
+	LOCK(pSensorHub);
+	pCmd = newCommand(pSensorHub, SH_CR_CAL_CONFIG, callback, cookie);
+	if (pCmd == 0) {
+		UNLOCK(pSensorHub);
+		return SH_STATUS_BUSY;
+	}
 
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
-	uint8_t thisSeq = pSensorHub->commandSeq++;
-
-	// format a request to get counts
+	// format a request to configure calibration
 	request.reportId = SH_COMMAND_REQUEST;
-	request.sequence = thisSeq;
+	request.sequence = pCmd->cmdSeq;
 	request.command = SH_CR_CAL_CONFIG;
 	request.accel = (sensors & SH_CAL_ACCEL) ? 1 : 0;
 	request.gyro =  (sensors & SH_CAL_GYRO)  ? 1 : 0;
 	request.mag =   (sensors & SH_CAL_MAG)   ? 1 : 0;
 
-	// send the request
-	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
-	if (rc != 0) return rc;
-
-	int replies = 0;
-	while (replies < 1) {
-		// get reply
-		reportLen = sizeof(response);
-		rc = shhid_in(pSensorHub->hid, &response, &reportLen, SH_TIMEOUT_MS, 0);
-		if (rc != 0) return rc;
-		
-		// ignore if not the right message
-		if ((reportLen != sizeof(sh_CommandResp_t)) ||
-		    (response.reportId != SH_COMMAND_RESPONSE)) {
-			continue;
-		}
-
-		sh_CommandResp_t *cmdResp = (sh_CommandResp_t *)&response;
-
-		// ignore if not the response to this command
-		if ((cmdResp->command != SH_CR_CAL_CONFIG) ||
-		    (cmdResp->cmdSeq != thisSeq)) {
-			continue;
-		}
-
-		sh_CalConfigResp_t * calCfgResp = (sh_CalConfigResp_t *)&response;
-
-		// copy status to rc for return
-		rc = calCfgResp->status;
-
-		replies++;
-	}
+	rc = startCommand(pSensorHub, pCmd, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 
 	return rc;
 }
@@ -963,6 +1370,7 @@ int sh_rvSync(void *sh, sh_RvSyncOp_t rvSyncOp)
 	// zero the report before sending
 	memset(&request, 0, sizeof(request));
 
+	LOCK(pSensorHub);
 	uint8_t thisSeq = pSensorHub->commandSeq++;
 
 	// format a request to get counts
@@ -973,6 +1381,7 @@ int sh_rvSync(void *sh, sh_RvSyncOp_t rvSyncOp)
 
 	// send the request
 	rc = shhid_setOutReport(pSensorHub->hid, &request, sizeof(request));
+	UNLOCK(pSensorHub);
 
 	return rc;
 }
@@ -980,147 +1389,725 @@ int sh_rvSync(void *sh, sh_RvSyncOp_t rvSyncOp)
 
 // --- Private utility functions --------------------------------------------------------------
 
-static int decodeEvent(sh_SensorEvent_t *event, sh_HidReport_t *report, uint16_t length, uint32_t timestamp)
+// Clear the state of a SensorHub being opened, and give it its event ring.
+static void resetHub(sh_SensorHub_t *pSensorHub, unsigned unit, sh_SensorEvent_t *ring, uint16_t ringLen)
 {
-	sh_SensorEventReport_t *r = (sh_SensorEventReport_t *)report;
-	static uint64_t time_us = 0;
-	static uint32_t last_timestamp = 0;
-	int32_t delta_t;
-	uint32_t delay;
-	
-	if (length > SHHID_MAX_INPUT_REPORT_LEN) {
-		return SH_STATUS_BAD_PARAM;
-	}
+	pSensorHub->unit = unit;
+	pSensorHub->ring = ring;
+	pSensorHub->ringMask = ringLen - 1;
+	pSensorHub->ringHead = 0;
+	pSensorHub->ringTail = 0;
+	pSensorHub->ringOverflows = 0;
+	pSensorHub->time_us = 0;
+	pSensorHub->lastTimestamp = 0;
+	memset(pSensorHub->cmd, 0, sizeof(pSensorHub->cmd));
+	memset(pSensorHub->subscriber, 0, sizeof(pSensorHub->subscriber));
+	pSensorHub->sensorFilter = 0xFFFFFFFF;
+	pSensorHub->reportTap = 0;
+	memset(pSensorHub->delivery, 0, sizeof(pSensorHub->delivery));
+	memset(pSensorHub->seqValid, 0, sizeof(pSensorHub->seqValid));
+	memset(pSensorHub->missed, 0, sizeof(pSensorHub->missed));
+#if SH_METADATA_CACHE
+	memset(pSensorHub->metadataValid, 0, sizeof(pSensorHub->metadataValid));
+#endif
+}
 
-	// Only sensor events (reportId <= 0x7F) are decoded by this function
-	if (report->reportId >= 0x80) {
-		return SH_STATUS_BAD_REPORT;
+// Finish opening a SensorHub once its HID layer is up.
+static void startHub(sh_SensorHub_t *pSensorHub)
+{
+	STATS(pSensorHub->stats = shhid_getStats(pSensorHub->hid));
+
+#if SH_METADATA_CACHE && SH_METADATA_PREFETCH
+	// Failures just leave that sensor uncached
+	sh_SensorMetadata_t metadata;
+	for (int n = 0; n <= SH_MAX_SENSOR_ID; n++) {
+		if (metadataRecord[n] != 0) {
+			sh_getMetadata(pSensorHub, (sh_SensorId_t)n, &metadata);
+		}
 	}
+#endif
+}
 
-	// Compute delay
-	delay = r->delay * (1 << ((r->status >> 2) & 0x07));
+// Decode a sensor report into the event ring.  Returns true if the event was queued.
+static bool queueEvent(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t reportLen, uint32_t timestamp)
+{
+	uint16_t head = pSensorHub->ringHead;
+	sh_SensorEvent_t *slot = &pSensorHub->ring[head & pSensorHub->ringMask];
 
-	// timestamp processing
-	delta_t = timestamp - last_timestamp;
-	last_timestamp = timestamp;
-	time_us += delta_t;
-	event->time_us = time_us - delay;
-	
-	// Common fields
-	event->sensor = r->reportId;
-	event->sequenceNumber = r->sequenceNumber;
-	event->status = r->status;
-	event->delay = r->delay;
+	if ((uint16_t)(head - SH_LOAD_ACQUIRE(&pSensorHub->ringTail)) > pSensorHub->ringMask) {
+		// Ring full: the report has been read, but its event is lost.
+		SH_STORE_RELEASE(&pSensorHub->ringOverflows, pSensorHub->ringOverflows + 1);
+		return false;
+	}
 
-	// Do sensor-specific stuff
-	switch (event->sensor) {
-		/* Reports that are 1 16-bit integer */
-	case SH_HUMIDITY:
-	case SH_PROXIMITY:
-	case SH_TEMPERATURE:
-	case SH_SIGNIFICANT_MOTION:
-	case SH_SHAKE_DETECTOR:
-	case SH_FLIP_DETECTOR:
-	case SH_PICKUP_DETECTOR:
-	case SH_STABILITY_DETECTOR:
-		if (length < 6)
-			return SH_STATUS_BAD_REPORT;
-
-		event->un.field16[0] = read16(&r->data[0]);
-		break;
+	if (decodeEvent(pSensorHub, slot, report, reportLen, timestamp) != SH_STATUS_SUCCESS) {
+		return false;
+	}
 
-		/* Reports that are 1 32-bit integer */
-	case SH_PRESSURE:
-	case SH_AMBIENT_LIGHT:
-	case SH_STEP_DETECTOR:
-		if (length < 8)
-			return SH_STATUS_BAD_REPORT;
+	// Publish the slot only after its contents are written
+	SH_STORE_RELEASE(&pSensorHub->ringHead, head + 1);
 
-		event->un.field32[0] = read32(&r->data[0]);
-		break;
+	return true;
+}
 
-		/* 4 16-bit integers and a 32-bit timestamp */
-	case SH_RAW_ACCELEROMETER:
-	case SH_RAW_GYROSCOPE:
-	case SH_RAW_MAGNETOMETER:
-		if (length < 16)
-			return SH_STATUS_BAD_REPORT;
-
-		event->un.field16[0] = read16(&r->data[0]);
-		event->un.field16[1] = read16(&r->data[2]);
-		event->un.field16[2] = read16(&r->data[4]);
-		event->un.field16[3] = read16(&r->data[6]);
-		event->un.field32[2] = read32(&r->data[8]);
-		break;
+// Get the next non-sensor input report, e.g. a response to a request.
+// Sensor events read along the way are saved for sh_getEvent().
+static int readResponse(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t *reportLen)
+{
+	int rc;
+	uint32_t timestamp;
 
-		/* Reports that are 3 16-bit integers */
-	case SH_ACCELEROMETER:
-	case SH_LINEAR_ACCELERATION:
-	case SH_GRAVITY:
-	case SH_GYROSCOPE_CALIBRATED:
-	case SH_MAGNETIC_FIELD_CALIBRATED:
-		if (length < 10)
-			return SH_STATUS_BAD_REPORT;
-
-		event->un.field16[0] = read16(&r->data[0]);
-		event->un.field16[1] = read16(&r->data[2]);
-		event->un.field16[2] = read16(&r->data[4]);
-		break;
+	while (true) {
+		*reportLen = sizeof(*report);
+		rc = readReport(pSensorHub, report, reportLen, SH_TIMEOUT_MS, &timestamp);
+		if (rc != SH_STATUS_SUCCESS) return rc;
 
-		/* Reports that are 4 16-bit integers */
-	case SH_GAME_ROTATION_VECTOR:
-		if (length < 12)
-			return SH_STATUS_BAD_REPORT;
+		// Only sensor events (reportId <= 0x7F) go to the event ring
+		if (report->reportId >= 0x80) return rc;
 
-		event->un.field16[0] = read16(&r->data[0]);
-		event->un.field16[1] = read16(&r->data[2]);
-		event->un.field16[2] = read16(&r->data[4]);
-		event->un.field16[3] = read16(&r->data[6]);
-		break;
+		queueEvent(pSensorHub, report, *reportLen, timestamp);
+	}
+}
+
+// shhid_in() plus any bookkeeping needed for every input report.
+static int readReport(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t *reportLen, uint16_t wait_ms, uint32_t *pTimestamp)
+{
+	int rc = shhid_in(pSensorHub->hid, report, reportLen, wait_ms, pTimestamp);
+	if (rc == SH_STATUS_HUB_RESET) hubReset(pSensorHub);
+	if (rc != SH_STATUS_SUCCESS) return rc;
+
+	noteReport(pSensorHub, report, *reportLen, *pTimestamp);
+
+	return rc;
+}
+
+// With a lock, wait for INTN before taking it, so other threads can use
+// the hub meanwhile.  Returns the part of the wait left to do under the lock.
+static uint16_t waitUnlocked(sh_SensorHub_t *pSensorHub, uint16_t wait_ms)
+{
+#if SHDEV_LOCK
+	if (wait_ms != 0) {
+		shdev_waitIntn(pSensorHub->dev, wait_ms);
+	}
+	return 0;
+#else
+	return wait_ms;
+#endif
+}
+
+// Count a sensor report and any reports its sequence number shows were missed.
+static void trackSequence(sh_SensorHub_t *pSensorHub, uint8_t sensorId, uint8_t seq)
+{
+	sh_DeliveryCounts_t *counts = &pSensorHub->delivery[sensorId];
+	uint8_t missed = 0;
+
+	if (pSensorHub->seqValid[sensorId]) {
+		uint8_t last = pSensorHub->lastSeq[sensorId];
+
+		if (seq == last) {
+			// Same report again, nothing missed
+			counts->duplicates++;
+		}
+		else {
+			missed = (uint8_t)(seq - last - 1);
+			if (missed != 0) {
+				counts->dropped += missed;
+				counts->gaps++;
+			}
+
+			// Moving forward, a smaller number means it passed 255 to 0
+			if (seq < last) {
+				counts->wraps++;
+			}
+		}
+	}
+
+	counts->delivered++;
+	pSensorHub->lastSeq[sensorId] = seq;
+	pSensorHub->seqValid[sensorId] = true;
+	pSensorHub->missed[sensorId] = missed;
+}
+
+// Bookkeeping needed for every input report, however it was read.
+static void noteReport(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t reportLen, uint32_t timestamp)
+{
+	if (pSensorHub->reportTap != 0) {
+		pSensorHub->reportTap(pSensorHub, pSensorHub->reportTapCookie,
+		                      (const uint8_t *)report, reportLen, timestamp);
+	}
+
+#if SH_DRIVER_STATS
+	if (report->reportId <= SH_MAX_SENSOR_ID) {
+		pSensorHub->stats->sensorReports[report->reportId]++;
+	}
+	else if ((report->reportId & 0xF0) == 0x80) {
+		pSensorHub->stats->controlReports[report->reportId & 0x0F]++;
+	}
+	else {
+		pSensorHub->stats->otherReports++;
+	}
+#endif
+
+	if ((report->reportId <= SH_MAX_SENSOR_ID) && (reportLen >= 2)) {
+		trackSequence(pSensorHub, report->reportId, report->body[0]);
+	}
+
+	// Note FRS record changes, whichever path read the notification
+	if ((report->reportId == SH_COMMAND_RESPONSE) &&
+	    (reportLen >= sizeof(sh_FrsChangeNotif_t))) {
+		sh_FrsChangeNotif_t *notif = (sh_FrsChangeNotif_t *)report;
+		if (notif->command == SH_CR_FRS_CHANGE) {
+			invalidateMetadata(pSensorHub, notif->frsType);
+		}
+	}
+
+	// Collect responses to outstanding commands
+	if (report->reportId == SH_COMMAND_RESPONSE) {
+		commandResponse(pSensorHub, report, reportLen);
+	}
+}
+
+// Claim a free command slot for a new request
+static sh_Command_t * newCommand(sh_SensorHub_t *pSensorHub, uint8_t command, sh_CommandCallback_t *callback, void *cookie)
+{
+	sh_Command_t *pCmd = 0;
+
+	for (int n = 0; n < SH_MAX_COMMANDS; n++) {
+		if (pSensorHub->cmd[n].state == SH_CMD_IDLE) {
+			pCmd = &pSensorHub->cmd[n];
+			break;
+		}
+	}
+	if (pCmd == 0) {
+		return 0;
+	}
+
+	pCmd->command = command;
+	pCmd->cmdSeq = pSensorHub->commandSeq++;
+	pCmd->replies = 0;
+	pCmd->status = SH_STATUS_SUCCESS;
+	pCmd->callback = callback;
+	pCmd->cookie = cookie;
+
+	return pCmd;
+}
+
+// Send a command request and start collecting its responses
+static int startCommand(sh_SensorHub_t *pSensorHub, sh_Command_t *pCmd, void *request, uint16_t requestLen)
+{
+	int rc;
+
+#if SH_COMMAND_TIMEOUT_MS
+	pCmd->deadline_us = shdev_getTime_us(pSensorHub->dev) + SH_COMMAND_TIMEOUT_MS * 1000u;
+#endif
+
+	// Responses may be read (by sh_serviceIntn) as soon as the request is out
+	SH_MEMORY_BARRIER();
+	pCmd->state = SH_CMD_WAITING;
+
+	rc = shhid_setOutReport(pSensorHub->hid, request, requestLen);
+	if (rc != SH_STATUS_SUCCESS) {
+		pCmd->state = SH_CMD_IDLE;
+	}
+
+	return rc;
+}
+
+static void finishCommand(sh_Command_t *pCmd, int status)
+{
+	pCmd->status = status;
+	SH_MEMORY_BARRIER();
+	pCmd->state = SH_CMD_DONE;
+}
+
+// Finish commands still waiting for responses with status.  expiredOnly:
+// just those past their deadline.
+static void failCommands(sh_SensorHub_t *pSensorHub, int status, bool expiredOnly)
+{
+#if SH_COMMAND_TIMEOUT_MS
+	uint32_t now_us = shdev_getTime_us(pSensorHub->dev);
+#endif
+
+	for (int n = 0; n < SH_MAX_COMMANDS; n++) {
+		sh_Command_t *pCmd = &pSensorHub->cmd[n];
+		if (pCmd->state != SH_CMD_WAITING) continue;
+#if SH_COMMAND_TIMEOUT_MS
+		if (expiredOnly && ((int32_t)(now_us - pCmd->deadline_us) < 0)) continue;
+#endif
+		finishCommand(pCmd, status);
+	}
+}
+
+// The hub reset itself: it won't answer requests made before
+static void hubReset(sh_SensorHub_t *pSensorHub)
+{
+	failCommands(pSensorHub, SH_STATUS_HUB_RESET, false);
+
+	// Sequence numbers start again
+	memset(pSensorHub->seqValid, 0, sizeof(pSensorHub->seqValid));
+}
+
+// Outstanding command with this command code and sequence number, if any
+static sh_Command_t * findCommand(sh_SensorHub_t *pSensorHub, uint8_t command, uint8_t cmdSeq)
+{
+	for (int n = 0; n < SH_MAX_COMMANDS; n++) {
+		sh_Command_t *pCmd = &pSensorHub->cmd[n];
+		if ((pCmd->state != SH_CMD_IDLE) &&
+		    (pCmd->command == command) &&
+		    (pCmd->cmdSeq == cmdSeq)) {
+			return pCmd;
+		}
+	}
+
+	return 0;
+}
 
-		/* Reports that are 5 16-bit integers */
-	case SH_ROTATION_VECTOR:
-	case SH_GEOMAGNETIC_ROTATION_VECTOR:
-		if (length < 14)
-			return SH_STATUS_BAD_REPORT;
-
-		event->un.field16[0] = read16(&r->data[0]);
-		event->un.field16[1] = read16(&r->data[2]);
-		event->un.field16[2] = read16(&r->data[4]);
-		event->un.field16[3] = read16(&r->data[6]);
-		event->un.field16[4] = read16(&r->data[8]);
+// Store the content of a command response in the command it answers
+static void commandResponse(sh_SensorHub_t *pSensorHub, sh_HidReport_t *report, uint16_t reportLen)
+{
+	sh_CommandResp_t *cmdResp = (sh_CommandResp_t *)report;
+	sh_Command_t *pCmd;
+
+	if (reportLen != sizeof(sh_CommandResp_t)) return;
+
+	// ignore if not the response to an outstanding command
+	pCmd = findCommand(pSensorHub, cmdResp->command, cmdResp->cmdSeq);
+	if ((pCmd == 0) || (pCmd->state != SH_CMD_WAITING)) {
+		return;
+	}
+
+	switch (pCmd->command) {
+	case SH_CR_REPORT_ERRORS: {
+		sh_GetErrsResp_t *errResp = (sh_GetErrsResp_t *)report;
+
+		// detect end of response sequence
+		// Version 1.2.5 uses severity == 255 to denote no errors
+		// Version 1.8.x uses source == 255.
+		if ((errResp->source == 255) || (errResp->severity == 255)) {
+			*pCmd->out.errors.numErrors = pCmd->replies;
+			finishCommand(pCmd, SH_STATUS_SUCCESS);
+		}
+		else if (pCmd->replies < pCmd->out.errors.maxErrors) {
+			// store content if we still have room
+			sh_ErrorRecord_t *pError = &pCmd->out.errors.pErrors[pCmd->replies];
+			pError->severity = errResp->severity;
+			pError->sequence = errResp->errSeq;
+			pError->source   = errResp->source;
+			pError->error    = errResp->error;
+			pError->module   = errResp->module;
+			pError->code     = errResp->code;
+			pCmd->replies++;
+		}
 		break;
+	}
+
+	case SH_CR_COUNTS: {
+		sh_GetCountsResp_t *counts = (sh_GetCountsResp_t *)report;
+
+		// Check for bad status
+		if (counts->status != 1) {
+			finishCommand(pCmd, SH_STATUS_SH_ERR);
+			break;
+		}
 
-		/* Reports that are 6 16-bit integers */
-	case SH_GYROSCOPE_UNCALIBRATED:
-	case SH_MAGNETIC_FIELD_UNCALIBRATED:
-		if (length < 16)
-			return SH_STATUS_BAD_REPORT;
-
-		event->un.field16[0] = read16(&r->data[0]);
-		event->un.field16[1] = read16(&r->data[2]);
-		event->un.field16[2] = read16(&r->data[4]);
-		event->un.field16[3] = read16(&r->data[6]);
-		event->un.field16[4] = read16(&r->data[8]);
-		event->un.field16[5] = read16(&r->data[10]);
+		// store content, based on response seq num
+		if (counts->respSeq == 0) {
+			pCmd->out.pCounts->offered = counts->value[0];
+			pCmd->out.pCounts->accepted = counts->value[1];
+		}
+		else if (counts->respSeq == 1) {
+			pCmd->out.pCounts->on = counts->value[0];
+			pCmd->out.pCounts->attempted = counts->value[1];
+		}
+
+		pCmd->replies++;
+		if (pCmd->replies >= 2) {
+			finishCommand(pCmd, SH_STATUS_SUCCESS);
+		}
 		break;
+	}
 
-	case SH_STEP_COUNTER:
-		if (length < 12)
-			return SH_STATUS_BAD_REPORT;
+	case SH_CR_SAVE_DCD:
+		// status is 0 on success
+		finishCommand(pCmd, ((sh_DcdSaveNowResp_t *)report)->status);
+		break;
 
-		event->un.stepCounter.detectLatency = read32(&r->data[0]);
-		event->un.stepCounter.steps = read16(&r->data[4]);
-		event->un.stepCounter.reserved = read16(&r->data[6]);
+	case SH_CR_CAL_CONFIG:
+		finishCommand(pCmd, ((sh_CalConfigResp_t *)report)->status);
 		break;
 
-		/* TBD */
-	case SH_SAR:
-	case SH_TAP_DETECTOR:
-	case SH_ACTIVITY_CLASSIFICATION:
 	default:
+		break;
+	}
+}
+
+// Read an FRS record, the body of sh_getFrs()
+static int frsRead(sh_SensorHub_t *pSensorHub, uint16_t recordId, uint32_t *pData, uint16_t *dataLenWords)
+{
+	int rc = SH_STATUS_SUCCESS;
+	sh_FrsReadReq_t outReport;
+	sh_HidReport_t inReport;
+	sh_FrsReadResp_t * readResp;
+	uint16_t reportLen;
+	bool done = false;
+	uint8_t words;
+	uint8_t offset;
+	uint16_t lastCopied = 0;
+	uint8_t status;
+	uint16_t readLenWords;
+	uint16_t n = 0;
+
+	// store incoming dataLenWords, set outgoing to zero in case we return w/o setting data.
+	readLenWords = *dataLenWords;
+	*dataLenWords = 0;
+  
+	// Issue FRS read request
+	outReport.reportId = SH_FRS_READ_REQUEST;
+	outReport.reserved = 0;
+	outReport.offset = 0;
+	outReport.recordId = recordId;
+	outReport.readLenWords = readLenWords;
+  
+	shhid_setOutReport(pSensorHub->hid, &outReport, sizeof(outReport));
+
+	// Collect FRS read responses
+	while (!done) {
+		// Get the next response
+		rc = readResponse(pSensorHub, &inReport, &reportLen);
+
+		// if poll fails, we fail
+		if (rc != SH_STATUS_SUCCESS) return rc;
+
+		// Ignore anything but FRS Read responses for the requested recordId
+		if (reportLen != sizeof(sh_FrsReadResp_t)) continue;
+
+		if (inReport.reportId != SH_FRS_READ_RESPONSE) continue;
+		
+		readResp = (sh_FrsReadResp_t *)&inReport;
+		if (readResp->recordId != recordId) continue;
+
+		// Check status
+		status = readResp->words_status & 0x0F;
+    
+		if (status == SH_FRS_READ_UNRECOGNIZED) return SH_STATUS_FRS_READ_UNRECOGNIZED_FRS;
+		if (status == SH_FRS_READ_BUSY) return SH_STATUS_FRS_READ_BUSY;
+		if (status == SH_FRS_READ_OUT_OF_RANGE) return SH_STATUS_FRS_READ_OFFSET_OUT_OF_RANGE;
+		if (status == SH_FRS_READ_DEVICE_ERROR) return SH_STATUS_FRS_READ_DEVICE_ERROR;
+
+		if (status == SH_FRS_READ_EMPTY) {
+			*dataLenWords = 0;
+			return SH_STATUS_SUCCESS;
+		}
+		
+		// Store this portion of FRS record
+		words = (readResp->words_status >> 4) & 0x0F;
+		offset = readResp->offset;
+
+		for (n = 0; n < words; n++) {
+			if (offset+n >= readLenWords) {
+				rc = SH_STATUS_FRS_READ_UNEXPECTED_LENGTH;
+			}
+			else {
+				lastCopied = offset+n;
+				pData[lastCopied] = readResp->dataWord[n];
+			}
+		}
+
+		// Check for done condition
+		if ((status == SH_FRS_READ_RECORD_COMPLETED) ||
+		    (status == SH_FRS_READ_BLOCK_COMPLETED) ||
+		    (status == SH_FRS_READ_BOTH_COMPLETED)) {
+			done = true;
+		}
+	}
+
+	// set dataLenWords to last offset copied + 1 for return
+	*dataLenWords = lastCopied+1;
+  
+	return rc;
+}
+
+// Write an FRS record, the body of sh_setFrs()
+static int frsWrite(sh_SensorHub_t *pSensorHub, uint16_t recordId, uint32_t *pData, uint16_t dataLen)
+{
+	sh_FrsWriteReq_t writeReq;
+	sh_FrsWriteDataReq_t writeDataReq[SH_FRS_WRITE_WINDOW];
+	unsigned numDataReqs;
+	sh_HidReport_t inReport;
+	sh_FrsWriteResp_t *writeResp;
+	uint16_t len;
+	uint16_t toWrite = dataLen;
+	uint16_t offset = 0;
+	uint16_t inFlight = 0;
+	int rc;
+	uint16_t status;
+
+	// Whatever happens below, a cached copy of this record can't be trusted
+	invalidateMetadata(pSensorHub, recordId);
+  
+	// Issue FRS write request
+	writeReq.reportId = SH_FRS_WRITE_REQUEST;
+	writeReq.reserved = 0;
+	writeReq.dataLen = dataLen;
+	writeReq.recordId = recordId;
+	shhid_setOutReport(pSensorHub->hid, &writeReq, sizeof(writeReq));
+
+	while (true) {
+		// Get Write Response
+		rc = readResponse(pSensorHub, &inReport, &len);
+		if (rc != 0) {
+			return rc;
+		}
+
+		// If this isn't a write response, ignore it
+		if (inReport.reportId != SH_FRS_WRITE_RESPONSE) {
+			continue;
+		}
+		if (len != sizeof(sh_FrsWriteResp_t)) {
+			continue;
+		}
+
+		writeResp = (sh_FrsWriteResp_t *)&inReport;
+		status = writeResp->status;
+    
+		// Check for errors
+		if (status == SH_FRS_WRITE_UNRECOGNIZED)
+			return SH_STATUS_FRS_WRITE_BAD_TYPE;
+		if (status == SH_FRS_WRITE_BUSY)
+			return SH_STATUS_FRS_WRITE_BUSY;
+		if (status == SH_FRS_WRITE_FAILED)
+			return SH_STATUS_FRS_WRITE_FAILED;
+		if (status == SH_FRS_WRITE_BAD_MODE)
+			return SH_STATUS_FRS_WRITE_BAD_MODE;
+		if (status == SH_FRS_WRITE_BAD_LEN)
+			return SH_STATUS_FRS_WRITE_BAD_LENGTH;
+		if (status == SH_FRS_WRITE_INVALID)
+			return SH_STATUS_FRS_WRITE_INVALID_RECORD;
+		if (status == SH_FRS_WRITE_DEVICE_ERR)
+			return SH_STATUS_FRS_WRITE_DEVICE_ERROR;
+		if (status == SH_FRS_WRITE_READ_ONLY)
+			return SH_STATUS_FRS_WRITE_READ_ONLY;
+
+		// Each OK or COMPLETED answers one data request
+		if (((status == SH_FRS_WRITE_OK) || (status == SH_FRS_WRITE_COMPLETED)) &&
+		    (inFlight > 0)) {
+			inFlight--;
+		}
+
+		// Check for successful completion condition
+		if ((status == SH_FRS_WRITE_COMPLETED) &&
+		    (toWrite == 0)) {
+			return SH_STATUS_SUCCESS;
+		}
+
+		// Check for SH ended before we were ready
+		if (status == SH_FRS_WRITE_COMPLETED)
+			return SH_STATUS_FRS_WRITE_NOT_ENOUGH;
+
+		// Only READY and OK invite more data
+		if ((status != SH_FRS_WRITE_READY) && (status != SH_FRS_WRITE_OK))
+			continue;
+
+		// Keep the window full
+		numDataReqs = 0;
+		while ((toWrite > 0) && (inFlight < SH_FRS_WRITE_WINDOW)) {
+			sh_FrsWriteDataReq_t *req = &writeDataReq[numDataReqs++];
+
+			req->reportId = SH_FRS_WRITE_DATA_REQUEST;
+			req->reserved = 0;
+			req->wordOffset = offset;
+
+			// set data[0] field
+			req->data[0] = pData[offset++];
+			req->data[1] = 0;
+			toWrite -= 1;
+			if (toWrite > 0) {
+				// set data[1], too
+				req->data[1] = pData[offset++];
+				toWrite -= 1;
+			}
+			inFlight++;
+		}
+
+		// Issue FRS write data requests together
+		if (numDataReqs > 0) {
+			rc = shhid_setOutReports(pSensorHub->hid, writeDataReq, sizeof(writeDataReq[0]), numDataReqs);
+			if (rc != 0) {
+				return rc;
+			}
+		}
+	}
+
+	// should never get here.  return is from inside the loop
+}
+
+// Wait for a command submitted without a callback and release it.
+// Responses to other outstanding commands are collected meanwhile.
+static int waitCommand(sh_SensorHub_t *pSensorHub, uint8_t cmdSeq)
+{
+	sh_Command_t *pCmd = 0;
+	sh_HidReport_t report;
+	uint16_t reportLen;
+	int rc = SH_STATUS_SUCCESS;
+
+	for (int n = 0; n < SH_MAX_COMMANDS; n++) {
+		if ((pSensorHub->cmd[n].state != SH_CMD_IDLE) &&
+		    (pSensorHub->cmd[n].callback == 0) &&
+		    (pSensorHub->cmd[n].cmdSeq == cmdSeq)) {
+			pCmd = &pSensorHub->cmd[n];
+			break;
+		}
+	}
+	if (pCmd == 0) return SH_STATUS_ERROR;
+
+	while (pCmd->state == SH_CMD_WAITING) {
+		rc = readResponse(pSensorHub, &report, &reportLen);
+		if (rc != SH_STATUS_SUCCESS) break;
+	}
+
+	// sh_serviceIntn may have read the last response meanwhile
+	if (pCmd->state == SH_CMD_DONE) {
+		rc = pCmd->status;
+	}
+	pCmd->state = SH_CMD_IDLE;
+
+	return rc;
+}
+
+// Discard cached metadata held in FRS record recordId
+static void invalidateMetadata(sh_SensorHub_t *pSensorHub, uint16_t recordId)
+{
+#if SH_METADATA_CACHE
+	for (int n = 0; n <= SH_MAX_SENSOR_ID; n++) {
+		if (metadataRecord[n] == recordId) {
+			pSensorHub->metadataValid[n] = false;
+		}
+	}
+#endif
+}
+
+// Read and parse a sensor's metadata record.
+static int readMetadata(sh_SensorHub_t *pSensorHub, sh_SensorId_t sensorId, sh_SensorMetadata_t *pData)
+{
+	uint32_t frsData[MAX_FRS_WORDS];
+	uint16_t frsDataLen;
+	uint16_t recordId = metadataRecord[sensorId];
+
+	// Fetch the metadata
+	frsDataLen = ARRAY_LEN(frsData);
+	int rc = frsRead(pSensorHub, recordId, frsData, &frsDataLen);
+	if (rc != 0) {
+		return rc;
+	}
+
+	// Don't parse (or cache) a missing or truncated record
+	if (frsDataLen == 0) {
+		return SH_STATUS_FRS_READ_EMPTY;
+	}
+	if (frsDataLen < 7) {
+		return SH_STATUS_FRS_READ_UNEXPECTED_LENGTH;
+	}
+  
+	// Populate the sensorMetadata structure with results
+	pData->meVersion        = (frsData[0] >> 0) & 0xFF;
+	pData->mhVersion        = (frsData[0] >> 8) & 0xFF;
+	pData->shVersion        = (frsData[0] >> 16) & 0xFF;
+	pData->range            = frsData[1];
+	pData->resolution       = frsData[2];
+	pData->power_mA         = (frsData[3] >> 0) & 0xFFFF;    // 16.10 forma = Xt
+	pData->revision         = (frsData[3] >> 16) & 0xFFFF;
+	pData->minPeriod_uS     = frsData[4];
+	pData->fifoMax          = (frsData[5] >> 0) & 0xFFFF;
+	pData->fifoReserved     = (frsData[5] >> 16) & 0xFFFF;
+	pData->batchBufferBytes = (frsData[6] >> 0) & 0xFFFF;;
+	pData->vendorIdLen      = (frsData[6] >> 16) & 0xFFFF;
+	strcpy(pData->vendorId, ""); // init with empty string in case vendorIdLen == 0
+
+	if (pData->vendorIdLen > ARRAY_LEN(pData->vendorId)) {
+		return SH_STATUS_BAD_PARAM;
+	}
+	if (pData->revision == 0) {
+		memcpy(pData->vendorId, (uint8_t *)&frsData[7], pData->vendorIdLen);
+	}
+	else if (pData->revision == 1) {
+		pData->qPoint1        = (frsData[7] >> 0) & 0xFFFF;
+		pData->qPoint2        = (frsData[7] >> 16) & 0xFFFF;
+		memcpy(pData->vendorId, (uint8_t *)&frsData[8], pData->vendorIdLen);
+	}
+	else if (pData->revision == 2) {
+		pData->qPoint1        = (frsData[7] >> 0) & 0xFFFF;
+		pData->qPoint2        = (frsData[7] >> 16) & 0xFFFF;
+		pData->sensorSpecificLen = (frsData[8] >> 0) & 0xFFFF;
+		if (pData->sensorSpecificLen > ARRAY_LEN(pData->sensorSpecific)) {
+			return SH_STATUS_BAD_PARAM;
+		}
+		memcpy(pData->sensorSpecific, (uint8_t *)&frsData[9], pData->sensorSpecificLen);
+		int vendorIdOffset = 9 + ((pData->sensorSpecificLen+3)/4); // 9 + one word for every 4 bytes of SS data
+		memcpy(pData->vendorId, (uint8_t *)&frsData[vendorIdOffset],
+		       pData->vendorIdLen);
+	}
+	else {
+		// Unrecognized revision!
+	}
+
+	return SH_STATUS_SUCCESS;
+}
+
+static int decodeEvent(sh_SensorHub_t *pSensorHub, sh_SensorEvent_t *event, sh_HidReport_t *report, uint16_t length, uint32_t timestamp)
+{
+	sh_SensorEventReport_t *r = (sh_SensorEventReport_t *)report;
+	uint32_t delta_t;
+	uint32_t delay;
+	
+	if (length > SHHID_MAX_INPUT_REPORT_LEN) {
+		return SH_STATUS_BAD_PARAM;
+	}
+
+	// Only sensor events (reportId <= 0x7F) are decoded by this function
+	if (report->reportId >= 0x80) {
 		return SH_STATUS_BAD_REPORT;
 	}
+
+	// Compute delay
+	delay = r->delay * (1 << ((r->status >> 2) & 0x07));
+
+	// timestamp processing: extend the 32-bit INTN timestamp to 64 bits.
+	// Unsigned subtraction gives the right delta across a wrap of the
+	// 32-bit counter (every ~71.6 minutes.)
+	delta_t = timestamp - pSensorHub->lastTimestamp;
+	pSensorHub->lastTimestamp = timestamp;
+	pSensorHub->time_us += delta_t;
+	event->time_us = (pSensorHub->time_us > delay) ? (pSensorHub->time_us - delay) : 0;
+	
+	// Filtered out sensors only keep the time base up to date
+	if ((r->reportId > SH_MAX_SENSOR_ID) || ((pSensorHub->sensorFilter & ((uint32_t)1 << r->reportId)) == 0)) {
+		return SH_STATUS_BAD_REPORT;
+	}
+
+	// Common fields
+	event->sensor = r->reportId;
+	event->sequenceNumber = r->sequenceNumber;
+	event->missed = pSensorHub->missed[r->reportId];
+	event->status = r->status;
+	event->delay = r->delay;
+
+	// Unpack sensor-specific fields as described by the layout table
+	const sh_SensorLayout_t *layout = &sensorLayout[event->sensor];
+	if ((layout->slots == 0) || (length < 4 + 2*layout->slots)) {
+		STATS(pSensorHub->stats->decodeFailures++);
+		return SH_STATUS_BAD_REPORT;
+	}
+
+	for (int n = 0; n < layout->slots; ) {
+		if (layout->wide & (1 << n)) {
+			event->un.field32[n/2] = read32(&r->data[2*n]);
+			n += 2;
+		}
+		else {
+			event->un.field16[n] = read16(&r->data[2*n]);
+			n += 1;
+		}
+	}
   
 	return SH_STATUS_SUCCESS;
 }
@@ -21,10 +21,49 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "sh_types.h"
 
 #define SH1_DRIVER_VERSION "1.1.1"
 
+// Depth of the per-SensorHub event ring used by sh_serviceIntn().  Must be a power of 2.
+// SensorHubs opened with sh_open() take theirs from sh_Config_t instead.
+#ifndef SH_EVENT_RING_LEN
+#define SH_EVENT_RING_LEN (16)
+#endif
+
+// Set to 0 to leave out the per-SensorHub metadata cache used by sh_getMetadata().
+#ifndef SH_METADATA_CACHE
+#define SH_METADATA_CACHE (1)
+#endif
+
+// Set to 1 to have sh_init() read every sensor's metadata into the cache.
+#ifndef SH_METADATA_PREFETCH
+#define SH_METADATA_PREFETCH (0)
+#endif
+
+// Number of FRS write data requests sh_setFrs() may have awaiting a response.
+#ifndef SH_FRS_WRITE_WINDOW
+#define SH_FRS_WRITE_WINDOW (4)
+#endif
+
+// Number of commands (synchronous or not) that may await responses at once.
+#ifndef SH_MAX_COMMANDS
+#define SH_MAX_COMMANDS (8)
+#endif
+
+// Time sh_service() allows an asynchronous command's responses before
+// failing it with SH_STATUS_TIMEOUT, e.g. 1000.  Needs shdev_getTime_us().
+// 0 (the default): no limit.
+#ifndef SH_COMMAND_TIMEOUT_MS
+#define SH_COMMAND_TIMEOUT_MS (0)
+#endif
+
+// Set to 1 to collect sh_getDriverStats() counters.  Needs shdev_getTime_us().
+#ifndef SH_DRIVER_STATS
+#define SH_DRIVER_STATS (0)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,12 +73,57 @@ extern "C" {
  *
  * This function should be called before any others in the API.  It returns
  * a void * which is used a reference to the SensorHub in all other API calls.
+ * Fails for units at or above MAX_SH_UNITS; use sh_open() for those.
  * 
  * @param  unit Which SensorHub to open if the system supports multiple units.
  * @return      Reference to the SensorHub or NULL on failure.
  */
 void * sh_init(unsigned unit);
 
+/**
+ * @brief Settings for a SensorHub opened with sh_open().
+ */
+typedef struct sh_Config_s {
+	/** Passed to shdev_init() to find the device.  Not limited to
+	 *  MAX_SH_UNITS, but the platform's shdev_init() must accept it. */
+	unsigned unit;
+
+	/** Depth of the event ring.  Must be a power of 2. */
+	uint16_t eventRingLen;
+} sh_Config_t;
+
+/**
+ * @brief Fill a configuration structure with default values.
+ *
+ * @param[out] config  Storage for the default configuration.
+ */
+void sh_getDefaultConfig(sh_Config_t *config);
+
+/**
+ * @brief Memory sh_open() needs for a SensorHub.
+ *
+ * @param  config  The configuration the SensorHub will be opened with.
+ * @return         Arena size in bytes, or 0 if config is invalid.
+ */
+size_t sh_getArenaSize(const sh_Config_t *config);
+
+/**
+ * @brief Initialize a session with a SensorHub held in caller memory.
+ *
+ * Like sh_init(), but all of the SensorHub's state (the SensorHub and
+ * HID layer state, metadata cache and event ring) is placed in arena
+ * rather than in static storage, so the number of SensorHubs can be
+ * chosen at run time.  The arena must stay valid, and not be moved,
+ * while the SensorHub is used.  The driver has no close function: when
+ * the SensorHub is no longer used, the arena may be reused.
+ *
+ * @param  config    Settings, e.g. from sh_getDefaultConfig().
+ * @param  arena     At least sh_getArenaSize(config) bytes, 8-byte aligned.
+ * @param  arenaLen  Size of arena, in bytes.
+ * @return           Reference to the SensorHub or NULL on failure.
+ */
+void * sh_open(const sh_Config_t *config, void *arena, size_t arenaLen);
+
 /**
  * @brief Read the current configuration of a sensor.
  *
@@ -73,7 +157,8 @@ int sh_setSensorConfig(void *sh,
 /**
  * @brief Checks for a sensor event.
  * 
- * Returns true if a sensor event is ready to read.
+ * Returns true if a sensor event is ready to read: INTN is asserted or
+ * events read during other calls are waiting in the event ring.
  * 
  * @param      sh       The SensorHub reference obtained via sh_init().
  * @return              true if data ready.
@@ -108,12 +193,115 @@ int sh_getEvent(void *sh, sh_SensorEvent_t *pEvent);
  */
 int sh_getEventTO(void *sh, uint16_t timeout_ms, sh_SensorEvent_t *pEvent);
 
+/**
+ * @brief Read a batch of sensor events from the SensorHub.
+ * 
+ * Waits up to timeout_ms for the first event, then keeps reading for as
+ * long as the SensorHub has more input reports pending, without blocking
+ * again.  Stops when maxEvents events have been stored or the SensorHub
+ * has nothing more to send.  Reports that are not sensor events are
+ * discarded.
+ * 
+ * @param      sh          The SensorHub reference obtained via sh_init().
+ * @param[out] pEvents     Storage for the events that are read.
+ * @param      maxEvents   Size of the pEvents array.
+ * @param      timeout_ms  Max time to wait for the first event. [ms]
+ * @return                 Number of events stored (0 if none arrived) or some failure code.
+ */
+int sh_getEvents(void *sh, sh_SensorEvent_t *pEvents, uint16_t maxEvents, uint16_t timeout_ms);
+
+/**
+ * @brief Service the SensorHub interrupt, queueing events for later.
+ *
+ * Intended to be called from the INTN interrupt handler or from a worker
+ * task woken by it.  With SHDEV_LOCK set it takes the device lock, so it
+ * must then be called from a task, never from the interrupt handler.
+ * Reads and decodes every input report the SensorHub has pending into a
+ * per-SensorHub event ring, where the application retrieves them with
+ * sh_popEvent().  If the ring is full, reports are
+ * still read (so the SensorHub FIFO keeps draining) but the events are
+ * discarded and counted as overflows.
+ *
+ * The ring has a single producer and a single consumer: only one context
+ * may call sh_serviceIntn() and only one may call sh_popEvent().  Other
+ * API calls that use the bus must not run concurrently with
+ * sh_serviceIntn().
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @return              Number of events queued or some failure code.
+ */
+int sh_serviceIntn(void *sh);
+
+/**
+ * @brief Take the oldest event from the event ring.
+ *
+ * Never touches the bus.  Safe to call while another context is running
+ * sh_serviceIntn().
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @param[out] pEvent   Storage for the event.
+ * @return              SH_STATUS_SUCCESS or SH_STATUS_NO_DATA if the ring is empty.
+ */
+int sh_popEvent(void *sh, sh_SensorEvent_t *pEvent);
+
+/**
+ * @brief Read the number of events discarded because the event ring was full.
+ *
+ * @param      sh          The SensorHub reference obtained via sh_init().
+ * @param[out] pOverflows  Number of events lost since sh_init().
+ * @return                 SH_STATUS_SUCCESS or some failure code.
+ */
+int sh_getEventOverflows(void *sh, uint32_t *pOverflows);
+
+/**
+ * @brief Read the driver's own statistics for a SensorHub.
+ *
+ * Counts bus traffic, input reports by id and decoding failures, and
+ * keeps histograms of INTN-to-read latency and bus transaction time.
+ * Only available when the driver is built with SH_DRIVER_STATS set to 1.
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @param[out] pStats   Statistics since sh_init() or sh_clearDriverStats().
+ * @return              SH_STATUS_SUCCESS, or SH_STATUS_ERROR if not built in.
+ */
+int sh_getDriverStats(void *sh, sh_DriverStats_t *pStats);
+
+/**
+ * @brief Reset the driver's statistics for a SensorHub to zero.
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @return              SH_STATUS_SUCCESS, or SH_STATUS_ERROR if not built in.
+ */
+int sh_clearDriverStats(void *sh);
+
+/**
+ * @brief Move the oldest records of the HID traffic trace out of the driver.
+ *
+ * Every input report, output report, SET_REPORT and GET_REPORT is recorded
+ * with its time, status and contents in a ring of SHHID_TRACE_LEN records
+ * per SensorHub.  Records are SHHID_TRACE_REC_LEN bytes, laid out as
+ * described in SensorHubHid.h; scripts/shtrace/shtrace.py decodes them.
+ * Only available when the driver is built with SHHID_TRACE_LEN above 0.
+ *
+ * @param      sh          The SensorHub reference obtained via sh_init().
+ * @param[out] pBuf        Space for maxRecords records.
+ * @param      maxRecords  Most records to move.
+ * @return                 Number of records moved, or SH_STATUS_ERROR if not built in.
+ */
+int sh_readTrace(void *sh, uint8_t *pBuf, unsigned maxRecords);
+
 /**
  * @brief Get Metadata related to a particular sensor.
  * 
  * The Metadata describes the sensor's range of operating rates, 
  * manufacturer identification, etc.
  * 
+ * Unless SH_METADATA_CACHE is 0, the first successful read for each sensor
+ * is cached and later calls are answered without any bus traffic.  A
+ * sensor's cache entry is discarded when its metadata record is written
+ * with sh_setFrs() or the SensorHub reports a change to that record, and
+ * the whole cache is discarded by sh_init().
+ * 
  * @param      sh       The SensorHub reference obtained via sh_init().
  * @param      sensorId Which sensor to operate on.
  * @param[out] pData    Contains the requested metadata on return.
@@ -151,6 +339,10 @@ int sh_getFrs(void *sh,
  * On a system with flash-based FRS, this data is permanently stored in the
  * SensorHub.  Devices with RAM-based FRS storage will not keep this data
  * so key FRS records need to be re-written at startup using this function.
+ *
+ * Data is sent two words per request, with up to SH_FRS_WRITE_WINDOW
+ * requests sent ahead of the SensorHub's responses.  Build with
+ * SH_FRS_WRITE_WINDOW set to 1 to wait for each response in turn.
  * 
  * @param      sh       The SensorHub reference obtained via sh_init().
  * @param      recordId Which record to access.
@@ -208,6 +400,51 @@ int sh_getCounts(void *sh,
                  sh_SensorId_t sensorId,
                  sh_Counts_t *pCounts);
 
+/**
+ * @brief Read the driver's count of delivered and dropped reports for a sensor.
+ *
+ * The driver follows each sensor's report sequence numbers as reports
+ * are read, on every path, whether or not they are decoded.  A jump in
+ * the sequence means reports were lost before reaching the host, for
+ * example to hub FIFO overflow when the host doesn't keep up.  The
+ * number missing before each event is also given in its missed field.
+ * Following starts again after a hub reset and after sh_setSensorConfig()
+ * for the sensor, so a restarted sequence isn't counted as a gap.
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @param      sensorId Which sensor.
+ * @param[out] pCounts  Counts since sh_init() or sh_clearDeliveryCounts().
+ * @return              SH_STATUS_SUCCESS or SH_STATUS_BAD_PARAM.
+ */
+int sh_getDeliveryCounts(void *sh,
+                         sh_SensorId_t sensorId,
+                         sh_DeliveryCounts_t *pCounts);
+
+/**
+ * @brief Reset the driver's delivery counts for all sensors to zero.
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @return              SH_STATUS_SUCCESS.
+ */
+int sh_clearDeliveryCounts(void *sh);
+
+/**
+ * @brief Read the internal counters of several sensors.
+ *
+ * Equivalent to calling sh_getCounts() for each sensor in turn, but keeps
+ * up to SH_MAX_COMMANDS requests outstanding so the SensorHub can work
+ * on them back to back.
+ *
+ * @param      sh          The SensorHub reference obtained via sh_init().
+ * @param      sensorIds   Which sensors to read.
+ * @param      numSensors  Number of entries in sensorIds.
+ * @param[out] pCounts     Counter values, one entry per sensorIds entry.
+ * @return                 SH_STATUS_SUCCESS or the first failure code.
+ */
+int sh_getCountsMulti(void *sh,
+                      const sh_SensorId_t *sensorIds, uint16_t numSensors,
+                      sh_Counts_t *pCounts);
+
 /**
  * @brief Clear counters associated with a sensor.
  *
@@ -329,6 +566,164 @@ int sh_calConfig(void *sh,
 int sh_rvSync(void *sh,
               sh_RvSyncOp_t rvSyncOp);
 
+/**
+ * @brief Completion callback for asynchronous commands.
+ *
+ * @param  sh      The SensorHub reference the command was submitted to.
+ * @param  cookie  The value given when the command was submitted.
+ * @param  status  The result the synchronous form of the command would
+ *                 have returned.
+ */
+typedef void sh_CommandCallback_t(void *sh, void *cookie, int status);
+
+/**
+ * @brief Handler for one sensor's events.
+ *
+ * @param  sh      The SensorHub reference the subscription was made on.
+ * @param  cookie  The value given to sh_subscribe().
+ * @param  pEvent  The event.  Only valid for the duration of the call.
+ */
+typedef void sh_EventCallback_t(void *sh, void *cookie, const sh_SensorEvent_t *pEvent);
+
+/**
+ * @brief Read pending input reports, dispatch events and complete commands.
+ *
+ * Events from sensors with a subscriber (see sh_subscribe()) are passed
+ * to its callback.  Other sensor events are added to the event ring, as
+ * with sh_serviceIntn().  Events already in the ring are dispatched first,
+ * up to the first one without a subscriber.  Responses to commands
+ * submitted with the ...Async() functions are collected and the callbacks
+ * of completed commands are made.  Commands without a response after
+ * SH_COMMAND_TIMEOUT_MS complete with SH_STATUS_TIMEOUT, and all outstanding
+ * commands complete with SH_STATUS_HUB_RESET if the SensorHub resets.
+ * Event and command callbacks are called from here, and only from here.
+ * Does not block.
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @return              Number of events dispatched or added to the ring, or some failure code.
+ */
+int sh_service(void *sh);
+
+/**
+ * @brief Set or clear the handler for a sensor's events.
+ *
+ * @param  sh        The SensorHub reference obtained via sh_init().
+ * @param  sensorId  Which sensor.
+ * @param  callback  Called from sh_service() with each event.  NULL to unsubscribe.
+ * @param  cookie    Passed to callback.
+ * @return           SH_STATUS_SUCCESS or SH_STATUS_BAD_PARAM.
+ */
+int sh_subscribe(void *sh, sh_SensorId_t sensorId, sh_EventCallback_t *callback, void *cookie);
+
+/**
+ * @brief Handler that sees each input report before it is decoded.
+ *
+ * @param  sh         The SensorHub reference the tap was set on.
+ * @param  cookie     The value given to sh_setReportTap().
+ * @param  report     The report, starting with its report id.  Only valid
+ *                    for the duration of the call.
+ * @param  reportLen  Length of the report, including report id.
+ * @param  timestamp  shdev_getTimestamp_us() value for the report. [uS]
+ */
+typedef void sh_ReportCallback_t(void *sh, void *cookie, const uint8_t *report,
+                                 uint16_t reportLen, uint32_t timestamp);
+
+/**
+ * @brief Set or clear a handler for every input report read from the hub.
+ *
+ * The handler is called with each report as it is read, on every path,
+ * before the report is decoded or dispatched.  Reports from all sensors
+ * are passed on, whatever sh_setSensorFilter() says, and so are
+ * responses.  shrec_record() in SensorHubRec.c can be used here to record
+ * the reports to a file.
+ *
+ * @param  sh        The SensorHub reference obtained via sh_init().
+ * @param  callback  The handler.  NULL to clear it.
+ * @param  cookie    Passed to callback.
+ * @return           SH_STATUS_SUCCESS.
+ */
+int sh_setReportTap(void *sh, sh_ReportCallback_t *callback, void *cookie);
+
+/**
+ * @brief Choose which sensors' reports are decoded.
+ *
+ * Reports from sensors whose bit is clear are read and discarded without
+ * being decoded, on every path: sh_getEvent(), sh_getEvents(),
+ * sh_serviceIntn() and sh_service().  All sensors are enabled by
+ * sh_init().  Passing the set of subscribed sensors makes sh_service()
+ * skip everything else.
+ *
+ * @param  sh          The SensorHub reference obtained via sh_init().
+ * @param  sensorMask  Bit n set: decode reports from sensor id n.
+ * @return             SH_STATUS_SUCCESS or some failure code.
+ */
+int sh_setSensorFilter(void *sh, uint32_t sensorMask);
+
+/**
+ * @brief Submit a request for the SensorHub error queue.
+ *
+ * Asynchronous form of sh_getErrors().  pErrors and numErrors must stay
+ * valid until the callback is made.
+ *
+ * @param         sh        The SensorHub reference obtained via sh_init().
+ * @param         severity  All errors at this severity and higher are returned.
+ * @param[out]    pErrors   Storage for returned errors.
+ * @param[in,out] numErrors Size of pErrors array.  Number of errors retrieved on completion.
+ * @param         callback  Called from sh_service() on completion.
+ * @param         cookie    Passed to callback.
+ * @return        SH_STATUS_SUCCESS, SH_STATUS_BUSY or some failure code.
+ */
+int sh_getErrorsAsync(void *sh,
+                      uint8_t severity,
+                      sh_ErrorRecord_t *pErrors, uint16_t *numErrors,
+                      sh_CommandCallback_t *callback, void *cookie);
+
+/**
+ * @brief Submit a request for a sensor's internal counters.
+ *
+ * Asynchronous form of sh_getCounts().  pCounts must stay valid until
+ * the callback is made.
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @param      sensorId Which sensor to operate on.
+ * @param[out] pCounts  The counter values retrieved.
+ * @param      callback Called from sh_service() on completion.
+ * @param      cookie   Passed to callback.
+ * @return              SH_STATUS_SUCCESS, SH_STATUS_BUSY or some failure code.
+ */
+int sh_getCountsAsync(void *sh,
+                      sh_SensorId_t sensorId,
+                      sh_Counts_t *pCounts,
+                      sh_CommandCallback_t *callback, void *cookie);
+
+/**
+ * @brief Submit a request to save dynamic calibration data now.
+ *
+ * Asynchronous form of sh_dcdSaveNow().
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @param      callback Called from sh_service() on completion.
+ * @param      cookie   Passed to callback.
+ * @return              SH_STATUS_SUCCESS, SH_STATUS_BUSY or some failure code.
+ */
+int sh_dcdSaveNowAsync(void *sh,
+                       sh_CommandCallback_t *callback, void *cookie);
+
+/**
+ * @brief Submit a change to dynamic calibration behavior.
+ *
+ * Asynchronous form of sh_calConfig().
+ *
+ * @param      sh       The SensorHub reference obtained via sh_init().
+ * @param      sensors  SH_CAL_ACCEL, SH_CAL_GYRO and SH_CAL_MAG flags.
+ * @param      callback Called from sh_service() on completion.
+ * @param      cookie   Passed to callback.
+ * @return              SH_STATUS_SUCCESS, SH_STATUS_BUSY or some failure code.
+ */
+int sh_calConfigAsync(void *sh,
+                      uint8_t sensors,
+                      sh_CommandCallback_t *callback, void *cookie);
+
 #ifdef __cplusplus
 }   // end of extern "C"
 #endif
@@ -39,11 +39,48 @@
 extern "C" {
 #endif
 
-// Defaults to supporting one sensorhub.
+// Units sh_init() can open, from storage allocated at compile time.
+// Defaults to supporting one sensorhub.  0 leaves that storage out, for
+// applications that only use sh_open().
 #ifndef MAX_SH_UNITS
 #define MAX_SH_UNITS (1)
 #endif
 
+// Set to 1 if the platform provides shdev_i2c_batch().
+#ifndef SHDEV_I2C_BATCH
+#define SHDEV_I2C_BATCH (0)
+#endif
+
+// Set to 1 if the platform provides shdev_i2c_async().
+#ifndef SHDEV_I2C_ASYNC
+#define SHDEV_I2C_ASYNC (0)
+#endif
+
+// Set to 1 if the platform provides shdev_lock() and shdev_unlock(), so a
+// SensorHub can be shared by several threads.
+#ifndef SHDEV_LOCK
+#define SHDEV_LOCK (0)
+#endif
+
+/**
+ * Completion callback for shdev_i2c_async().
+ *
+ * @param  cookie  The cookie passed to shdev_i2c_async().
+ * @param  status  SH_STATUS_SUCCESS or error code.
+ */
+typedef void (shdev_I2cDone_t)(void *cookie, sh_Status_t status);
+
+/**
+ * One transfer within shdev_i2c_batch(): a write, a read or both, as for
+ * shdev_i2c().
+ */
+typedef struct shdev_I2cXfer_s {
+	const uint8_t *pSend;   /**< @brief Data to send (or NULL) */
+	unsigned sendLen;       /**< @brief Number of bytes to send */
+	uint8_t *pReceive;      /**< @brief Buffer receiving data (or NULL) */
+	unsigned receiveLen;    /**< @brief Number of bytes to receive */
+} shdev_I2cXfer_t;
+
 /**
  * Initialize (open) a sensorhub device.
  * 
@@ -99,6 +136,44 @@ sh_Status_t shdev_i2c(void *pDev,
                       const uint8_t *pSend, unsigned sendLen,
                       uint8_t *pReceive, unsigned receiveLen);
 
+/**
+ * Perform several I2C transactions as one bus job.  (Optional.)
+ *
+ * Each transfer is carried out as shdev_i2c() would, in order, stopping at
+ * the first one that fails.  Platforms that can queue transfers together,
+ * such as Linux with one I2C_RDWR ioctl, should do so.  Only needed when
+ * SHDEV_I2C_BATCH is 1; otherwise the driver calls shdev_i2c() for each.
+ *
+ * @param  pDev      The device reference obtained via shdev_init().
+ * @param  pXfers    The transfers.
+ * @param  numXfers  Number of entries in pXfers.
+ * @return           SH_STATUS_SUCCESS or error code.
+ */
+sh_Status_t shdev_i2c_batch(void *pDev, const shdev_I2cXfer_t *pXfers, unsigned numXfers);
+
+/**
+ * Start an I2C transaction without waiting for it to finish.  (Optional.)
+ *
+ * Performs the same transaction as shdev_i2c(), for instance by DMA, and
+ * calls done exactly once when it has finished.  done may be called from
+ * an interrupt handler, or before this function returns.  The buffers
+ * must remain valid until then.  Only needed when SHDEV_I2C_ASYNC is 1;
+ * otherwise the driver uses shdev_i2c().
+ *
+ * @param       pDev       The device reference obtained via shdev_init().
+ * @param       pSend      Pointer to data to send (or NULL)
+ * @param       sendLen    Number of bytes to send
+ * @param[out]  pReceive   Pointer to buffer receiving data (or NULL)
+ * @param       receiveLen Size of pReceive buffer
+ * @param       done       Called when the transaction is complete.
+ * @param       cookie     Passed to done.
+ * @return      SH_STATUS_SUCCESS if started, or error code (done isn't called.)
+ */
+sh_Status_t shdev_i2c_async(void *pDev,
+                            const uint8_t *pSend, unsigned sendLen,
+                            uint8_t *pReceive, unsigned receiveLen,
+                            shdev_I2cDone_t *done, void *cookie);
+
 /**
  * Read the current state of INTN signal.
  *
@@ -129,6 +204,41 @@ bool shdev_waitIntn(void *pDev, uint16_t wait_ms);
  * @return         The timestamp (in units of microseconds) of last interrupt assertion.
  */
 uint32_t shdev_getTimestamp_us(void *pDev);
+
+/**
+ * Get the current time.
+ *
+ * Needed for command timeouts (if SH_COMMAND_TIMEOUT_MS is set), with
+ * SHDEV_I2C_ASYNC, and by optional instrumentation (BNO070_DFU_TIMING,
+ * SH_DRIVER_STATS and SHHID_TRACE_LEN.)  Uses the same time base as
+ * shdev_getTimestamp_us().
+ *
+ * @param  pDev    The device reference obtained via shdev_init().
+ * @return         The current time in microseconds.
+ */
+uint32_t shdev_getTime_us(void *pDev);
+
+/**
+ * Take the lock for a sensorhub device, blocking until it is available.
+ *
+ * Only needed when SHDEV_LOCK is 1.  The driver holds the lock while it
+ * uses the bus and while it updates the state shared by the threads using
+ * a SensorHub.  The lock must be recursive: a thread already holding it
+ * may take it again (e.g. from an sh_service() callback), and must
+ * release it as many times.  After sh_init(), shdev_waitIntn() and
+ * shdev_getIntn() may be called without the lock, possibly from several
+ * threads at once; the other shdev functions are called with it held.
+ *
+ * @param  pDev    The device reference obtained via shdev_init().
+ */
+void shdev_lock(void *pDev);
+
+/**
+ * Release the lock taken by shdev_lock().
+ *
+ * @param  pDev    The device reference obtained via shdev_init().
+ */
+void shdev_unlock(void *pDev);
 	
 #ifdef __cplusplus
 }    // end of extern "C"
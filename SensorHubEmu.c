@@ -0,0 +1,1410 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Host-only: needs clock_gettime() and recursive pthread mutexes
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+
+#include "SensorHubEmu.h"
+#include "SensorHubDev.h"
+#include "SensorHubHid.h"
+#include "SensorHubRec.h"
+#include "sh_util.h"
+
+#if SHDEV_LOCK
+#include <pthread.h>
+
+#define EMU_LOCK(pEmu) shdev_lock(pEmu)
+#define EMU_UNLOCK(pEmu) shdev_unlock(pEmu)
+#else
+#define EMU_LOCK(pEmu)
+#define EMU_UNLOCK(pEmu)
+#endif
+
+// Depth of the hub's sensor report FIFO.  Sensor reports beyond this are dropped.
+#ifndef SHEMU_FIFO_LEN
+#define SHEMU_FIFO_LEN (32)
+#endif
+
+// Total queue depth.  Responses may use the space above SHEMU_FIFO_LEN.
+#define SHEMU_QUEUE_LEN (SHEMU_FIFO_LEN + 32)
+
+// Responses still being worked on by the hub (see responseLatency_us)
+#define SHEMU_PENDING_LEN (SHEMU_QUEUE_LEN)
+
+// FRS storage
+#define SHEMU_FRS_RECORDS (48)
+#define SHEMU_FRS_WORDS (72)
+
+// HID descriptor fields
+#define SHEMU_HID_DESC_LEN (30)
+#define SHEMU_REPORT_DESC_MAX (1024)
+#define SHEMU_VENDOR_ID (0x1D5A)
+#define SHEMU_PRODUCT_ID (0x0070)
+
+// Reported software version
+#define SHEMU_SW_PART_NO (10003251)
+#define SHEMU_SW_VER_MAJOR (1)
+#define SHEMU_SW_VER_MINOR (8)
+#define SHEMU_SW_VER_PATCH (4)
+#define SHEMU_SW_BUILD_NO (415)
+
+#define SHEMU_VENDOR_STRING "Hillcrest Labs SH-1 Emulator"
+
+// Registers and opcodes of the HID over I2C protocol (see SensorHubHid.c)
+enum {
+	EMU_REG_HID_DESCRIPTOR    = 1,
+	EMU_REG_REPORT_DESCRIPTOR = 2,
+	EMU_REG_INPUT             = 3,
+	EMU_REG_OUTPUT            = 4,
+	EMU_REG_COMMAND           = 5,
+	EMU_REG_DATA              = 6,
+};
+
+enum {
+	EMU_TYPE_INPUT   = 0x10,
+	EMU_TYPE_OUTPUT  = 0x20,
+	EMU_TYPE_FEATURE = 0x30,
+};
+
+enum {
+	EMU_OP_RESET      = 0x01,
+	EMU_OP_GET_REPORT = 0x02,
+	EMU_OP_SET_REPORT = 0x03,
+};
+
+// DFU bootloader states
+enum emu_DfuState_e {
+	EMU_DFU_APP_LEN,
+	EMU_DFU_PACKET_LEN,
+	EMU_DFU_DATA,
+};
+
+// --- Private Types -----------------------------------------------------------
+
+// Static description of an emulated sensor
+typedef struct emu_SensorInfo_s {
+	uint8_t reportLen;      // Input report length including report id.  0: not emulated.
+	uint16_t metaRecordId;  // FRS record holding this sensor's metadata, 0 if none
+	uint8_t qPoint1;
+	uint8_t qPoint2;
+	uint32_t minPeriod_us;
+} emu_SensorInfo_t;
+
+typedef struct emu_Sensor_s {
+	sh_SensorConfigFeatureReport_t config;
+	uint64_t nextDue_us;
+	uint32_t samples;
+	uint8_t sequence;
+	uint32_t offered;
+	uint32_t accepted;
+} emu_Sensor_t;
+
+typedef struct emu_Report_s {
+	uint8_t len;            // Report length including report id, 0 for reset message
+	bool sensor;            // true if this is a sensor report (subject to FIFO limit)
+	uint32_t timestamp;     // INTN assertion time for this report
+	uint8_t data[SHHID_MAX_INPUT_REPORT_LEN];
+} emu_Report_t;
+
+typedef struct emu_FrsRecord_s {
+	bool valid;
+	uint16_t recordId;
+	uint16_t len;
+	uint32_t data[SHEMU_FRS_WORDS];
+} emu_FrsRecord_t;
+
+typedef struct Emu_s {
+	unsigned unit;
+	bool initialized;
+	shemu_Config_t config;
+	shemu_Stats_t stats;
+#if SHDEV_LOCK
+	pthread_mutex_t lock;      // shdev_lock(), recursive
+#endif
+
+	// Time base
+	uint64_t simTime_us;
+	struct timespec start;
+
+	// Input report queue
+	emu_Report_t queue[SHEMU_QUEUE_LEN];
+	unsigned head;
+	unsigned count;
+	unsigned sensorCount;
+	uint32_t intnTimestamp;
+
+	// Responses not yet available to the host, released in order
+	emu_Report_t pending[SHEMU_PENDING_LEN];
+	uint64_t pendingDue_us[SHEMU_PENDING_LEN];
+	unsigned pendingHead;
+	unsigned pendingCount;
+	uint64_t responseDue_us;   // When the last output report's responses are ready
+
+	// Recording replayed in place of generated sensor reports
+	shrec_File_t replay;
+	bool replaying;            // replayReport holds the next report
+	uint8_t replayReport[SHHID_MAX_INPUT_REPORT_LEN];
+	uint8_t replayLen;
+	uint32_t replayTimestamp;  // Its recorded timestamp
+	uint64_t replayDue_us;     // When it is produced
+
+	// Sensors
+	emu_Sensor_t sensor[SH_MAX_SENSOR_ID+1];
+
+	// FRS
+	emu_FrsRecord_t frs[SHEMU_FRS_RECORDS];
+	emu_FrsRecord_t *frsWrite;   // Record being written, if any
+	uint16_t frsWriteLen;
+	uint16_t frsWriteRecordId;
+	uint32_t frsWriteData[SHEMU_FRS_WORDS];
+	uint16_t frsWritten;
+
+	// Command/response
+	uint8_t responseSeq;
+
+	// DFU
+	bool dfuMode;
+	enum emu_DfuState_e dfuState;
+	uint8_t dfuAck;
+	uint32_t dfuAppLen;
+	uint32_t dfuReceived;
+	bool dfuDone;
+	uint64_t dfuBusyUntil_us;    // Programming the last packet until then
+
+	// Descriptors
+	uint8_t hidDesc[SHEMU_HID_DESC_LEN];
+	uint8_t reportDesc[SHEMU_REPORT_DESC_MAX];
+	uint16_t reportDescLen;
+} Emu_t;
+
+// --- Forward Declarations ----------------------------------------------------
+
+static Emu_t * emu_get(unsigned unit);
+static void emu_init(Emu_t *pEmu, unsigned unit);
+static void emu_appReset(Emu_t *pEmu);
+static uint64_t emu_now(Emu_t *pEmu);
+static void emu_spend(Emu_t *pEmu, uint64_t us);
+static sh_Status_t emu_i2c(Emu_t *pEmu, const uint8_t *pSend, unsigned sendLen,
+                           uint8_t *pReceive, unsigned receiveLen, bool overhead);
+static void emu_service(Emu_t *pEmu);
+static void emu_replayStart(Emu_t *pEmu);
+static void emu_replayNext(Emu_t *pEmu);
+static void emu_replayStop(Emu_t *pEmu);
+static uint64_t emu_nextDue(Emu_t *pEmu);
+static bool emu_enqueue(Emu_t *pEmu, const uint8_t *report, uint8_t len, bool sensor, uint32_t timestamp);
+static bool emu_queue(Emu_t *pEmu, const uint8_t *report, uint8_t len, bool sensor, uint32_t timestamp);
+static void emu_readInput(Emu_t *pEmu, uint8_t *pReceive, unsigned receiveLen);
+static void emu_command(Emu_t *pEmu, const uint8_t *pSend, unsigned sendLen, uint8_t *pReceive, unsigned receiveLen);
+static void emu_output(Emu_t *pEmu, const uint8_t *report, unsigned len);
+static void emu_setFeature(Emu_t *pEmu, uint8_t reportId, const uint8_t *payload, unsigned len);
+static void emu_getFeature(Emu_t *pEmu, uint8_t reportId, uint8_t *pReceive, unsigned receiveLen);
+static void emu_frsWrite(Emu_t *pEmu, const uint8_t *report);
+static void emu_frsWriteData(Emu_t *pEmu, const uint8_t *report);
+static void emu_frsRead(Emu_t *pEmu, const uint8_t *report);
+static void emu_commandRequest(Emu_t *pEmu, const uint8_t *report);
+static void emu_commandResp(Emu_t *pEmu, uint8_t command, uint8_t cmdSeq, uint8_t respSeq,
+                            const uint8_t *r, unsigned rLen);
+static emu_FrsRecord_t * emu_findFrs(Emu_t *pEmu, uint16_t recordId);
+static void emu_dfuWrite(Emu_t *pEmu, const uint8_t *pSend, unsigned sendLen);
+static void emu_dfuRead(Emu_t *pEmu, uint8_t *pReceive, unsigned receiveLen);
+static uint16_t emu_crc16(const uint8_t *data, unsigned len);
+
+// --- Private Data ------------------------------------------------------------
+
+static const emu_SensorInfo_t sensorInfo[SH_MAX_SENSOR_ID+1] = {
+	[SH_ACCELEROMETER]                = { 10, 0xE302,  8,  0,  2500 },
+	[SH_GYROSCOPE_CALIBRATED]         = { 10, 0xE306,  9,  0,  2500 },
+	[SH_MAGNETIC_FIELD_CALIBRATED]    = { 10, 0xE309,  4,  0, 10000 },
+	[SH_LINEAR_ACCELERATION]          = { 10, 0xE303,  8,  0,  2500 },
+	[SH_ROTATION_VECTOR]              = { 14, 0xE30B, 14, 12,  2500 },
+	[SH_GRAVITY]                      = { 10, 0xE304,  8,  0,  2500 },
+	[SH_GYROSCOPE_UNCALIBRATED]       = { 16, 0xE307,  9,  9,  2500 },
+	[SH_GAME_ROTATION_VECTOR]         = { 12, 0xE30C, 14,  0,  2500 },
+	[SH_GEOMAGNETIC_ROTATION_VECTOR]  = { 14, 0xE30D, 14, 12, 10000 },
+	[SH_PRESSURE]                     = {  8, 0xE30E, 20,  0, 20000 },
+	[SH_AMBIENT_LIGHT]                = {  8, 0xE30F,  8,  0, 20000 },
+	[SH_HUMIDITY]                     = {  6, 0xE310,  8,  0, 20000 },
+	[SH_PROXIMITY]                    = {  6, 0xE311,  4,  0, 20000 },
+	[SH_TEMPERATURE]                  = {  6, 0xE312,  7,  0, 20000 },
+	[SH_MAGNETIC_FIELD_UNCALIBRATED]  = { 16, 0xE30A,  4,  4, 10000 },
+	[SH_STEP_COUNTER]                 = { 12, 0xE315,  0,  0, 20000 },
+	[SH_SIGNIFICANT_MOTION]           = {  6, 0xE316,  0,  0, 20000 },
+	[SH_RAW_ACCELEROMETER]            = { 16, 0xE301,  0,  0,  2500 },
+	[SH_RAW_GYROSCOPE]                = { 16, 0xE305,  0,  0,  2500 },
+	[SH_RAW_MAGNETOMETER]             = { 16, 0xE308,  0,  0, 10000 },
+	[SH_STEP_DETECTOR]                = {  8, 0xE314,  0,  0, 20000 },
+	[SH_SHAKE_DETECTOR]               = {  6, 0xE318,  0,  0, 20000 },
+	[SH_FLIP_DETECTOR]                = {  6, 0xE319,  0,  0, 20000 },
+	[SH_PICKUP_DETECTOR]              = {  6, 0xE31A,  0,  0, 20000 },
+	[SH_STABILITY_DETECTOR]           = {  6, 0xE31B,  0,  0, 20000 },
+	[SH_SAR]                          = {  6,      0,  0,  0, 20000 },
+	[SH_TAP_DETECTOR]                 = {  6, 0xE313,  0,  0, 20000 },
+	[SH_ACTIVITY_CLASSIFICATION]      = {  6, 0xE317,  0,  0, 20000 },
+};
+
+// Emulated units
+static Emu_t emu[SHEMU_MAX_UNITS];
+
+// --- Public API --------------------------------------------------------------
+
+void shemu_getDefaultConfig(shemu_Config_t *config)
+{
+	config->realTime = false;
+	config->i2cOverhead_us = 20;
+	config->i2cByte_ns = 22500;
+	config->responseLatency_us = 0;
+	config->dfuProgram_us = 0;
+	config->keepShortReads = false;
+	config->replayPath = 0;
+}
+
+int shemu_configure(unsigned unit, const shemu_Config_t *config)
+{
+	Emu_t *pEmu = emu_get(unit);
+	if ((pEmu == 0) || (config == 0)) return SH_STATUS_BAD_PARAM;
+
+	pEmu->config = *config;
+
+	return SH_STATUS_SUCCESS;
+}
+
+int shemu_getStats(unsigned unit, shemu_Stats_t *stats)
+{
+	Emu_t *pEmu = emu_get(unit);
+	if ((pEmu == 0) || (stats == 0)) return SH_STATUS_BAD_PARAM;
+
+	EMU_LOCK(pEmu);
+	*stats = pEmu->stats;
+	EMU_UNLOCK(pEmu);
+
+	return SH_STATUS_SUCCESS;
+}
+
+int shemu_clearStats(unsigned unit)
+{
+	Emu_t *pEmu = emu_get(unit);
+	if (pEmu == 0) return SH_STATUS_BAD_PARAM;
+
+	EMU_LOCK(pEmu);
+	memset(&pEmu->stats, 0, sizeof(pEmu->stats));
+	EMU_UNLOCK(pEmu);
+
+	return SH_STATUS_SUCCESS;
+}
+
+bool shemu_replayDone(unsigned unit)
+{
+	Emu_t *pEmu = emu_get(unit);
+	if (pEmu == 0) return true;
+
+	return !pEmu->replaying;
+}
+
+uint64_t shemu_getTime_us(unsigned unit)
+{
+	Emu_t *pEmu = emu_get(unit);
+	if (pEmu == 0) return 0;
+
+	return emu_now(pEmu);
+}
+
+// --- shdev API ---------------------------------------------------------------
+
+void * shdev_init(int unit)
+{
+	if ((unit < 0) || (unit >= SHEMU_MAX_UNITS)) {
+		// no such unit
+		return 0;
+	}
+
+	return emu_get(unit);
+}
+
+sh_Status_t shdev_reset(void * pDev)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+
+	pEmu->dfuMode = false;
+	emu_appReset(pEmu);
+	emu_replayStart(pEmu);
+
+	return SH_STATUS_SUCCESS;
+}
+
+sh_Status_t shdev_reset_dfu(void * pDev)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+
+	// Sensors stop, pending reports are lost
+	emu_appReset(pEmu);
+	emu_replayStop(pEmu);
+	pEmu->head = 0;
+	pEmu->count = 0;
+	pEmu->sensorCount = 0;
+
+	pEmu->dfuMode = true;
+	pEmu->dfuState = EMU_DFU_APP_LEN;
+	pEmu->dfuAck = 0;
+	pEmu->dfuAppLen = 0;
+	pEmu->dfuReceived = 0;
+	pEmu->dfuDone = false;
+	pEmu->dfuBusyUntil_us = 0;
+
+	return SH_STATUS_SUCCESS;
+}
+
+sh_Status_t shdev_i2c(void *pDev,
+                      const uint8_t *pSend, unsigned sendLen,
+                      uint8_t *pReceive, unsigned receiveLen)
+{
+	return emu_i2c((Emu_t *)pDev, pSend, sendLen, pReceive, receiveLen, true);
+}
+
+sh_Status_t shdev_i2c_batch(void *pDev, const shdev_I2cXfer_t *pXfers, unsigned numXfers)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+	sh_Status_t rc = SH_STATUS_SUCCESS;
+
+	// One bus job: the fixed overhead is paid once
+	for (unsigned n = 0; (n < numXfers) && (rc == SH_STATUS_SUCCESS); n++) {
+		rc = emu_i2c(pEmu, pXfers[n].pSend, pXfers[n].sendLen,
+		             pXfers[n].pReceive, pXfers[n].receiveLen, (n == 0));
+	}
+
+	return rc;
+}
+
+sh_Status_t shdev_i2c_async(void *pDev,
+                            const uint8_t *pSend, unsigned sendLen,
+                            uint8_t *pReceive, unsigned receiveLen,
+                            shdev_I2cDone_t *done, void *cookie)
+{
+	// The emulated bus has no DMA: complete before returning
+	sh_Status_t rc = emu_i2c((Emu_t *)pDev, pSend, sendLen, pReceive, receiveLen, true);
+
+	done(cookie, rc);
+	return SH_STATUS_SUCCESS;
+}
+
+bool shdev_getIntn(void *pDev)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+	bool intn;
+
+	EMU_LOCK(pEmu);
+	emu_service(pEmu);
+
+	// INTN is active low
+	intn = (pEmu->count == 0);
+	EMU_UNLOCK(pEmu);
+
+	return intn;
+}
+
+bool shdev_waitIntn(void *pDev, uint16_t wait_ms)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+	uint64_t deadline;
+	bool intn;
+
+	EMU_LOCK(pEmu);
+	emu_service(pEmu);
+	intn = (pEmu->count == 0);
+	if (!intn || (wait_ms == 0)) {
+		EMU_UNLOCK(pEmu);
+		return intn;
+	}
+
+	deadline = emu_now(pEmu) + (uint64_t)wait_ms * 1000;
+
+	if (!pEmu->config.realTime) {
+		// Jump the simulated clock to the next event, if it comes in time
+		uint64_t next = emu_nextDue(pEmu);
+		if ((next == UINT64_MAX) && (wait_ms == SH_WAIT_FOREVER)) {
+			// Nothing will ever arrive
+			EMU_UNLOCK(pEmu);
+			return true;
+		}
+		if ((wait_ms == SH_WAIT_FOREVER) || (next <= deadline)) {
+			pEmu->simTime_us = next;
+		}
+		else {
+			pEmu->simTime_us = deadline;
+		}
+		emu_service(pEmu);
+		intn = (pEmu->count == 0);
+		EMU_UNLOCK(pEmu);
+		return intn;
+	}
+	EMU_UNLOCK(pEmu);
+
+	// Poll without holding the lock, so other threads can use the hub
+	while ((wait_ms == SH_WAIT_FOREVER) || (emu_now(pEmu) < deadline)) {
+		if (!shdev_getIntn(pDev)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+uint32_t shdev_getTimestamp_us(void *pDev)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+
+	return pEmu->intnTimestamp;
+}
+
+uint32_t shdev_getTime_us(void *pDev)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+
+	return (uint32_t)emu_now(pEmu);
+}
+
+#if SHDEV_LOCK
+void shdev_lock(void *pDev)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+
+	pthread_mutex_lock(&pEmu->lock);
+}
+
+void shdev_unlock(void *pDev)
+{
+	Emu_t *pEmu = (Emu_t *)pDev;
+
+	pthread_mutex_unlock(&pEmu->lock);
+}
+#endif
+
+// --- Private methods ---------------------------------------------------------
+
+static Emu_t * emu_get(unsigned unit)
+{
+	if (unit >= SHEMU_MAX_UNITS) {
+		return 0;
+	}
+
+	Emu_t *pEmu = &emu[unit];
+	if (!pEmu->initialized) {
+		emu_init(pEmu, unit);
+	}
+
+	return pEmu;
+}
+
+// One I2C transfer.  overhead: charge the fixed per-job cost.
+static sh_Status_t emu_i2c(Emu_t *pEmu,
+                           const uint8_t *pSend, unsigned sendLen,
+                           uint8_t *pReceive, unsigned receiveLen,
+                           bool overhead)
+{
+	uint64_t cost_ns = 0;
+
+	// Charge bus time: fixed overhead plus address byte and data for each phase
+	if (overhead) cost_ns = (uint64_t)pEmu->config.i2cOverhead_us * 1000;
+	if (sendLen > 0) cost_ns += (uint64_t)(sendLen + 1) * pEmu->config.i2cByte_ns;
+	if (receiveLen > 0) cost_ns += (uint64_t)(receiveLen + 1) * pEmu->config.i2cByte_ns;
+	emu_spend(pEmu, cost_ns / 1000);
+
+	if (overhead) pEmu->stats.transactions++;
+	pEmu->stats.bytesWritten += sendLen;
+	pEmu->stats.bytesRead += receiveLen;
+	pEmu->stats.busTime_us += cost_ns / 1000;
+
+	if (pEmu->dfuMode) {
+		if (sendLen > 0) emu_dfuWrite(pEmu, pSend, sendLen);
+		if (receiveLen > 0) emu_dfuRead(pEmu, pReceive, receiveLen);
+		return SH_STATUS_SUCCESS;
+	}
+
+	emu_service(pEmu);
+
+	if (receiveLen > 0) {
+		memset(pReceive, 0, receiveLen);
+	}
+
+	if (sendLen == 0) {
+		// Plain read: next input report
+		if (receiveLen > 0) emu_readInput(pEmu, pReceive, receiveLen);
+		return SH_STATUS_SUCCESS;
+	}
+
+	if (sendLen < 2) {
+		return SH_STATUS_ERROR_I2C_IO;
+	}
+
+	switch (read16(pSend)) {
+	case EMU_REG_HID_DESCRIPTOR:
+		memcpy(pReceive, pEmu->hidDesc,
+		       (receiveLen < sizeof(pEmu->hidDesc)) ? receiveLen : sizeof(pEmu->hidDesc));
+		break;
+
+	case EMU_REG_REPORT_DESCRIPTOR:
+		memcpy(pReceive, pEmu->reportDesc,
+		       (receiveLen < pEmu->reportDescLen) ? receiveLen : pEmu->reportDescLen);
+		break;
+
+	case EMU_REG_INPUT:
+		emu_readInput(pEmu, pReceive, receiveLen);
+		break;
+
+	case EMU_REG_OUTPUT:
+		// register, length (including length field), report
+		if (sendLen >= 5) {
+			unsigned len = read16(pSend+2) - 2;
+			if (len > sendLen - 4) len = sendLen - 4;
+			emu_output(pEmu, pSend+4, len);
+		}
+		break;
+
+	case EMU_REG_COMMAND:
+		emu_command(pEmu, pSend, sendLen, pReceive, receiveLen);
+		break;
+
+	default:
+		return SH_STATUS_ERROR_I2C_IO;
+	}
+
+	return SH_STATUS_SUCCESS;
+}
+
+static void emu_reportDescItem(Emu_t *pEmu, uint8_t tag, uint8_t value)
+{
+	if (pEmu->reportDescLen + 2 <= sizeof(pEmu->reportDesc)) {
+		pEmu->reportDesc[pEmu->reportDescLen++] = tag;
+		pEmu->reportDesc[pEmu->reportDescLen++] = value;
+	}
+}
+
+static void emu_reportDescReport(Emu_t *pEmu, uint8_t reportId, uint8_t len, uint8_t mainTag)
+{
+	emu_reportDescItem(pEmu, 0x85, reportId);   // Report ID
+	emu_reportDescItem(pEmu, 0x09, 0x01);       // Usage
+	emu_reportDescItem(pEmu, 0x75, 8);          // Report Size (bits)
+	emu_reportDescItem(pEmu, 0x95, len - 1);    // Report Count (excludes report id)
+	emu_reportDescItem(pEmu, mainTag, 0x02);    // Input/Output/Feature (Data, Var, Abs)
+}
+
+static void emu_init(Emu_t *pEmu, unsigned unit)
+{
+	memset(pEmu, 0, sizeof(*pEmu));
+	pEmu->unit = unit;
+	pEmu->initialized = true;
+	shemu_getDefaultConfig(&pEmu->config);
+	clock_gettime(CLOCK_MONOTONIC, &pEmu->start);
+
+#if SHDEV_LOCK
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&pEmu->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
+
+	// Report descriptor: one vendor-defined application collection
+	pEmu->reportDescLen = 0;
+	emu_reportDescItem(pEmu, 0x06, 0x00);   // Usage Page (Vendor 0xFF00)
+	pEmu->reportDesc[pEmu->reportDescLen++] = 0xFF;
+	emu_reportDescItem(pEmu, 0x09, 0x01);   // Usage
+	emu_reportDescItem(pEmu, 0xA1, 0x01);   // Collection (Application)
+	for (int id = 0; id <= SH_MAX_SENSOR_ID; id++) {
+		if (sensorInfo[id].reportLen == 0) continue;
+		emu_reportDescReport(pEmu, id, sensorInfo[id].reportLen, 0x81);
+		emu_reportDescReport(pEmu, id, sizeof(sh_SensorConfigFeatureReport_t), 0xB1);
+	}
+	emu_reportDescReport(pEmu, SH_PRODUCT_ID_REQUEST, sizeof(sh_ProdIdReq_t), 0x91);
+	emu_reportDescReport(pEmu, SH_PRODUCT_ID_RESPONSE, sizeof(sh_ProdIdResp_t), 0x81);
+	emu_reportDescReport(pEmu, SH_FRS_WRITE_REQUEST, sizeof(sh_FrsWriteReq_t), 0x91);
+	emu_reportDescReport(pEmu, SH_FRS_WRITE_DATA_REQUEST, sizeof(sh_FrsWriteDataReq_t), 0x91);
+	emu_reportDescReport(pEmu, SH_FRS_WRITE_RESPONSE, sizeof(sh_FrsWriteResp_t), 0x81);
+	emu_reportDescReport(pEmu, SH_FRS_READ_REQUEST, sizeof(sh_FrsReadReq_t), 0x91);
+	emu_reportDescReport(pEmu, SH_FRS_READ_RESPONSE, sizeof(sh_FrsReadResp_t), 0x81);
+	emu_reportDescReport(pEmu, SH_COMMAND_REQUEST, sizeof(sh_CommandReq_t), 0x91);
+	emu_reportDescReport(pEmu, SH_COMMAND_RESPONSE, sizeof(sh_CommandResp_t), 0x81);
+	pEmu->reportDesc[pEmu->reportDescLen++] = 0xC0;   // End Collection
+
+	// HID descriptor
+	write16(&pEmu->hidDesc[0], SHEMU_HID_DESC_LEN);
+	write16(&pEmu->hidDesc[2], 0x0100);
+	write16(&pEmu->hidDesc[4], pEmu->reportDescLen);
+	write16(&pEmu->hidDesc[6], EMU_REG_REPORT_DESCRIPTOR);
+	write16(&pEmu->hidDesc[8], EMU_REG_INPUT);
+	write16(&pEmu->hidDesc[10], SHHID_MAX_INPUT_REPORT_LEN+2);
+	write16(&pEmu->hidDesc[12], EMU_REG_OUTPUT);
+	write16(&pEmu->hidDesc[14], SHHID_MAX_OUTPUT_REPORT_LEN+2);
+	write16(&pEmu->hidDesc[16], EMU_REG_COMMAND);
+	write16(&pEmu->hidDesc[18], EMU_REG_DATA);
+	write16(&pEmu->hidDesc[20], SHEMU_VENDOR_ID);
+	write16(&pEmu->hidDesc[22], SHEMU_PRODUCT_ID);
+	write16(&pEmu->hidDesc[24], (SHEMU_SW_VER_MAJOR << 8) | SHEMU_SW_VER_MINOR);
+
+	// Populate FRS with a metadata record (revision 1) for each emulated sensor
+	emu_FrsRecord_t *rec = &pEmu->frs[0];
+	for (int id = 0; id <= SH_MAX_SENSOR_ID; id++) {
+		const emu_SensorInfo_t *info = &sensorInfo[id];
+		unsigned vendorLen = sizeof(SHEMU_VENDOR_STRING);
+
+		if ((info->reportLen == 0) || (info->metaRecordId == 0)) continue;
+
+		rec->valid = true;
+		rec->recordId = info->metaRecordId;
+		rec->data[0] = (SHEMU_SW_VER_MAJOR << 16) | (1 << 8) | 1;   // sh, mh, me versions
+		rec->data[1] = 0x7FFF;                                      // range
+		rec->data[2] = 1;                                           // resolution
+		rec->data[3] = (1u << 16) | (1 << 10);                      // revision 1, 1 mA
+		rec->data[4] = info->minPeriod_us;
+		rec->data[5] = 0;
+		rec->data[6] = (vendorLen << 16);
+		rec->data[7] = ((uint32_t)info->qPoint2 << 16) | info->qPoint1;
+		memcpy(&rec->data[8], SHEMU_VENDOR_STRING, vendorLen);
+		rec->len = 8 + (vendorLen + 3) / 4;
+		rec++;
+	}
+}
+
+// Application-mode reset: sensors off, queue holds only the reset message
+static void emu_appReset(Emu_t *pEmu)
+{
+	static const uint8_t resetMsg[1] = { 0 };
+
+	for (int id = 0; id <= SH_MAX_SENSOR_ID; id++) {
+		memset(&pEmu->sensor[id], 0, sizeof(pEmu->sensor[id]));
+		pEmu->sensor[id].config.reportId = id;
+	}
+	pEmu->frsWrite = 0;
+	pEmu->frsWriteLen = 0;
+	pEmu->frsWritten = 0;
+	pEmu->responseSeq = 0;
+
+	pEmu->pendingHead = 0;
+	pEmu->pendingCount = 0;
+	pEmu->responseDue_us = 0;
+
+	pEmu->head = 0;
+	pEmu->count = 0;
+	pEmu->sensorCount = 0;
+
+	// HID over I2C: hub presents a zero length report after reset
+	emu_enqueue(pEmu, resetMsg, 0, false, (uint32_t)emu_now(pEmu));
+}
+
+static uint64_t emu_now(Emu_t *pEmu)
+{
+	struct timespec ts;
+
+	if (!pEmu->config.realTime) {
+		return pEmu->simTime_us;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)(ts.tv_sec - pEmu->start.tv_sec) * 1000000 +
+		(ts.tv_nsec - pEmu->start.tv_nsec) / 1000;
+}
+
+// Consume time on behalf of a bus transaction
+static void emu_spend(Emu_t *pEmu, uint64_t us)
+{
+	if (!pEmu->config.realTime) {
+		pEmu->simTime_us += us;
+		return;
+	}
+
+	uint64_t until = emu_now(pEmu) + us;
+	while (emu_now(pEmu) < until) {
+		// busy wait, like a polled I2C peripheral
+	}
+}
+
+// Time at which the next sensor report or response will be produced
+static uint64_t emu_nextDue(Emu_t *pEmu)
+{
+	uint64_t next = UINT64_MAX;
+
+	for (int id = 0; id <= SH_MAX_SENSOR_ID; id++) {
+		emu_Sensor_t *s = &pEmu->sensor[id];
+		if ((s->config.reportInterval_uS != 0) && (s->nextDue_us < next)) {
+			next = s->nextDue_us;
+		}
+	}
+	if ((pEmu->pendingCount > 0) && (pEmu->pendingDue_us[pEmu->pendingHead] < next)) {
+		next = pEmu->pendingDue_us[pEmu->pendingHead];
+	}
+	if (pEmu->replaying && (pEmu->replayDue_us < next)) {
+		next = pEmu->replayDue_us;
+	}
+
+	return next;
+}
+
+static void emu_fillSensorData(sh_SensorId_t id, uint8_t *data, unsigned len, uint32_t sample, uint32_t t)
+{
+	for (unsigned i = 0; i + 1 < len; i += 2) {
+		write16(&data[i], (uint16_t)(sample * 31 + i * 1021));
+	}
+
+	switch (id) {
+	case SH_RAW_ACCELEROMETER:
+	case SH_RAW_GYROSCOPE:
+	case SH_RAW_MAGNETOMETER:
+		write32(&data[8], t);
+		break;
+	case SH_STEP_COUNTER:
+		write32(&data[0], 0);
+		write16(&data[4], (uint16_t)(sample / 50));
+		write16(&data[6], 0);
+		break;
+	default:
+		break;
+	}
+}
+
+// Produce all sensor reports due up to the current time
+static void emu_service(Emu_t *pEmu)
+{
+	uint64_t now = emu_now(pEmu);
+	uint8_t report[SHHID_MAX_INPUT_REPORT_LEN];
+
+	// Release responses the hub has finished
+	while ((pEmu->pendingCount > 0) && (pEmu->pendingDue_us[pEmu->pendingHead] <= now)) {
+		emu_Report_t *r = &pEmu->pending[pEmu->pendingHead];
+		emu_queue(pEmu, r->data, r->len, false, r->timestamp);
+		pEmu->pendingHead = (pEmu->pendingHead + 1) % SHEMU_PENDING_LEN;
+		pEmu->pendingCount--;
+	}
+
+	if (pEmu->config.replayPath != 0) {
+		// Recorded reports only, at their recorded intervals
+		while (pEmu->replaying && (pEmu->replayDue_us <= now)) {
+			pEmu->stats.reportsGenerated++;
+			emu_enqueue(pEmu, pEmu->replayReport, pEmu->replayLen, true, (uint32_t)pEmu->replayDue_us);
+			emu_replayNext(pEmu);
+		}
+		return;
+	}
+
+	for (int id = 0; id <= SH_MAX_SENSOR_ID; id++) {
+		emu_Sensor_t *s = &pEmu->sensor[id];
+		uint32_t interval = s->config.reportInterval_uS;
+		if (interval == 0) continue;
+
+		// Don't generate more than a FIFO's worth after a long stall
+		if (now > s->nextDue_us + (uint64_t)interval * SHEMU_QUEUE_LEN) {
+			uint64_t skipped = (now - s->nextDue_us) / interval - SHEMU_QUEUE_LEN;
+			pEmu->stats.reportsDropped += skipped;
+			s->sequence += skipped;
+			s->samples += skipped;
+			s->offered += skipped;
+			s->nextDue_us += skipped * interval;
+		}
+
+		while (s->nextDue_us <= now) {
+			uint8_t len = sensorInfo[id].reportLen;
+
+			report[0] = id;
+			report[1] = s->sequence++;
+			report[2] = 0x03;   // accuracy high, delay exponent 0
+			report[3] = 0;      // delay
+			emu_fillSensorData(id, &report[4], len - 4, s->samples++, (uint32_t)s->nextDue_us);
+
+			pEmu->stats.reportsGenerated++;
+			s->offered++;
+			if (emu_enqueue(pEmu, report, len, true, (uint32_t)s->nextDue_us)) {
+				s->accepted++;
+			}
+
+			s->nextDue_us += interval;
+		}
+	}
+}
+
+// (Re)start the recording, with its first report due now
+static void emu_replayStart(Emu_t *pEmu)
+{
+	emu_replayStop(pEmu);
+	if (pEmu->config.replayPath == 0) return;
+	if (shrec_open(&pEmu->replay, pEmu->config.replayPath) != SH_STATUS_SUCCESS) return;
+
+	pEmu->replaying = true;
+	emu_replayNext(pEmu);
+	if (pEmu->replaying) {
+		pEmu->replayDue_us = emu_now(pEmu);
+	}
+}
+
+// Fetch the next recorded sensor report.  Responses in the recording are
+// skipped; the emulator makes its own.
+static void emu_replayNext(Emu_t *pEmu)
+{
+	uint32_t prevTimestamp = pEmu->replayTimestamp;
+	uint16_t len;
+
+	do {
+		len = sizeof(pEmu->replayReport);
+		if (shrec_read(&pEmu->replay, pEmu->replayReport, &len, &pEmu->replayTimestamp) != SH_STATUS_SUCCESS) {
+			// End of the recording
+			emu_replayStop(pEmu);
+			return;
+		}
+	} while (pEmu->replayReport[0] > SH_MAX_SENSOR_ID);
+
+	pEmu->replayLen = len;
+	pEmu->replayDue_us += (uint32_t)(pEmu->replayTimestamp - prevTimestamp);
+}
+
+static void emu_replayStop(Emu_t *pEmu)
+{
+	shrec_close(&pEmu->replay);
+	pEmu->replaying = false;
+}
+
+// Queue an input report, or hold a response back until the hub is done with its request
+static bool emu_enqueue(Emu_t *pEmu, const uint8_t *report, uint8_t len, bool sensor, uint32_t timestamp)
+{
+	if (!sensor && (pEmu->responseDue_us > emu_now(pEmu))) {
+		if (pEmu->pendingCount >= SHEMU_PENDING_LEN) {
+			pEmu->stats.responsesDropped++;
+			return false;
+		}
+
+		unsigned ix = (pEmu->pendingHead + pEmu->pendingCount) % SHEMU_PENDING_LEN;
+		emu_Report_t *r = &pEmu->pending[ix];
+		r->len = len;
+		r->sensor = false;
+		r->timestamp = (uint32_t)pEmu->responseDue_us;
+		memcpy(r->data, report, len);
+		pEmu->pendingDue_us[ix] = pEmu->responseDue_us;
+		pEmu->pendingCount++;
+		return true;
+	}
+
+	return emu_queue(pEmu, report, len, sensor, timestamp);
+}
+
+static bool emu_queue(Emu_t *pEmu, const uint8_t *report, uint8_t len, bool sensor, uint32_t timestamp)
+{
+	if (sensor && (pEmu->sensorCount >= SHEMU_FIFO_LEN)) {
+		pEmu->stats.reportsDropped++;
+		return false;
+	}
+	if (pEmu->count >= SHEMU_QUEUE_LEN) {
+		if (sensor) pEmu->stats.reportsDropped++;
+		else pEmu->stats.responsesDropped++;
+		return false;
+	}
+
+	emu_Report_t *r = &pEmu->queue[(pEmu->head + pEmu->count) % SHEMU_QUEUE_LEN];
+	r->len = len;
+	r->sensor = sensor;
+	r->timestamp = timestamp;
+	memcpy(r->data, report, len);
+
+	if (pEmu->count == 0) {
+		// INTN asserts now
+		pEmu->intnTimestamp = timestamp;
+	}
+	pEmu->count++;
+	if (sensor) pEmu->sensorCount++;
+
+	return true;
+}
+
+static void emu_readInput(Emu_t *pEmu, uint8_t *pReceive, unsigned receiveLen)
+{
+	emu_Report_t *r;
+	unsigned copyLen;
+
+	if (pEmu->count == 0) {
+		// Nothing pending: zero length
+		return;
+	}
+
+	r = &pEmu->queue[pEmu->head];
+	if (receiveLen >= 2) {
+		write16(pReceive, (r->len == 0) ? 0 : r->len + 2);
+		copyLen = (r->len < receiveLen - 2) ? r->len : receiveLen - 2;
+		memcpy(pReceive + 2, r->data, copyLen);
+	}
+
+	if (pEmu->config.keepShortReads && (receiveLen < r->len + 2)) {
+		// Host only read part of it.  Offer it again next time.
+		return;
+	}
+
+	// The report is consumed even if the host read too few bytes
+	if (r->sensor) pEmu->sensorCount--;
+	pEmu->head = (pEmu->head + 1) % SHEMU_QUEUE_LEN;
+	pEmu->count--;
+
+	if (pEmu->count > 0) {
+		// INTN stays asserted for the next report
+		pEmu->intnTimestamp = pEmu->queue[pEmu->head].timestamp;
+	}
+}
+
+// Command register: RESET, GET_REPORT, SET_REPORT
+static void emu_command(Emu_t *pEmu, const uint8_t *pSend, unsigned sendLen, uint8_t *pReceive, unsigned receiveLen)
+{
+	uint8_t type;
+	uint8_t reportId;
+	uint8_t opcode;
+	unsigned ix;
+
+	if (sendLen < 4) return;
+
+	type = pSend[2] & 0x30;
+	reportId = pSend[2] & 0x0F;
+	opcode = pSend[3] & 0x0F;
+	ix = 4;
+	if (reportId == 0x0F) {
+		if (sendLen < 5) return;
+		reportId = pSend[4];
+		ix = 5;
+	}
+
+	if (opcode == EMU_OP_RESET) {
+		emu_appReset(pEmu);
+		return;
+	}
+
+	// Skip data register
+	ix += 2;
+
+	if (opcode == EMU_OP_GET_REPORT) {
+		if (type == EMU_TYPE_FEATURE) {
+			emu_getFeature(pEmu, reportId, pReceive, receiveLen);
+		}
+		return;
+	}
+
+	if ((opcode == EMU_OP_SET_REPORT) && (sendLen >= ix + 2)) {
+		unsigned len = read16(pSend + ix) - 2;
+		const uint8_t *payload = pSend + ix + 2;
+		if (len > sendLen - ix - 2) len = sendLen - ix - 2;
+
+		if (type == EMU_TYPE_FEATURE) {
+			emu_setFeature(pEmu, reportId, payload, len);
+		}
+		else if (type == EMU_TYPE_OUTPUT) {
+			uint8_t report[SHHID_MAX_REPORT_LEN+8];
+			if (len > sizeof(report) - 1) len = sizeof(report) - 1;
+			report[0] = reportId;
+			memcpy(&report[1], payload, len);
+			emu_output(pEmu, report, len + 1);
+		}
+	}
+}
+
+static void emu_setFeature(Emu_t *pEmu, uint8_t reportId, const uint8_t *payload, unsigned len)
+{
+	emu_Sensor_t *s;
+	uint32_t interval;
+
+	if ((reportId > SH_MAX_SENSOR_ID) || (sensorInfo[reportId].reportLen == 0)) return;
+	if (len < sizeof(sh_SensorConfigFeatureReport_t) - 1) return;
+
+	s = &pEmu->sensor[reportId];
+	s->config.reportId = reportId;
+	s->config.flags = payload[0];
+	s->config.changeSensitivity = read16(&payload[1]);
+	interval = read32(&payload[3]);
+	s->config.reserved1 = read32(&payload[7]);
+	s->config.sensorSpecific = read32(&payload[11]);
+
+	if ((interval != 0) && (interval < sensorInfo[reportId].minPeriod_us)) {
+		interval = sensorInfo[reportId].minPeriod_us;
+	}
+	if ((interval != 0) && (s->config.reportInterval_uS == 0)) {
+		// First report one period from now
+		s->nextDue_us = emu_now(pEmu) + interval;
+	}
+	s->config.reportInterval_uS = interval;
+}
+
+static void emu_getFeature(Emu_t *pEmu, uint8_t reportId, uint8_t *pReceive, unsigned receiveLen)
+{
+	uint8_t buffer[sizeof(sh_SensorConfigFeatureReport_t) + 1];
+	emu_Sensor_t *s;
+
+	if ((reportId > SH_MAX_SENSOR_ID) || (sensorInfo[reportId].reportLen == 0)) return;
+	s = &pEmu->sensor[reportId];
+
+	// length field, then report body (without report id)
+	write16(&buffer[0], sizeof(sh_SensorConfigFeatureReport_t) + 1);
+	buffer[2] = s->config.flags;
+	write16(&buffer[3], s->config.changeSensitivity);
+	write32(&buffer[5], s->config.reportInterval_uS);
+	write32(&buffer[9], s->config.reserved1);
+	write32(&buffer[13], s->config.sensorSpecific);
+
+	memcpy(pReceive, buffer, (receiveLen < sizeof(buffer)) ? receiveLen : sizeof(buffer));
+}
+
+// Output reports: report[0] holds the report id
+static void emu_output(Emu_t *pEmu, const uint8_t *report, unsigned len)
+{
+	uint8_t resp[SHHID_MAX_INPUT_REPORT_LEN];
+	uint32_t now = (uint32_t)emu_now(pEmu);
+
+	// The hub works through output reports one at a time
+	if (pEmu->config.responseLatency_us != 0) {
+		if (pEmu->responseDue_us < emu_now(pEmu)) {
+			pEmu->responseDue_us = emu_now(pEmu);
+		}
+		pEmu->responseDue_us += pEmu->config.responseLatency_us;
+	}
+
+	switch (report[0]) {
+	case SH_PRODUCT_ID_REQUEST:
+		for (int n = 0; n < SH_NUM_PRODUCT_IDS; n++) {
+			memset(resp, 0, sizeof(resp));
+			resp[0] = SH_PRODUCT_ID_RESPONSE;
+			resp[1] = (n == 0) ? 1 : 0;   // reset cause: power on
+			resp[2] = SHEMU_SW_VER_MAJOR;
+			resp[3] = SHEMU_SW_VER_MINOR;
+			write32(&resp[4], SHEMU_SW_PART_NO + n);
+			write32(&resp[8], SHEMU_SW_BUILD_NO);
+			write16(&resp[12], SHEMU_SW_VER_PATCH);
+			emu_enqueue(pEmu, resp, sizeof(sh_ProdIdResp_t), false, now);
+		}
+		break;
+
+	case SH_FRS_WRITE_REQUEST:
+		if (len >= sizeof(sh_FrsWriteReq_t)) emu_frsWrite(pEmu, report);
+		break;
+
+	case SH_FRS_WRITE_DATA_REQUEST:
+		if (len >= sizeof(sh_FrsWriteDataReq_t)) emu_frsWriteData(pEmu, report);
+		break;
+
+	case SH_FRS_READ_REQUEST:
+		if (len >= sizeof(sh_FrsReadReq_t)) emu_frsRead(pEmu, report);
+		break;
+
+	case SH_COMMAND_REQUEST:
+		if (len >= sizeof(sh_CommandReq_t)) emu_commandRequest(pEmu, report);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static emu_FrsRecord_t * emu_findFrs(Emu_t *pEmu, uint16_t recordId)
+{
+	for (int n = 0; n < SHEMU_FRS_RECORDS; n++) {
+		if (pEmu->frs[n].valid && (pEmu->frs[n].recordId == recordId)) {
+			return &pEmu->frs[n];
+		}
+	}
+
+	return 0;
+}
+
+static void emu_frsWriteResp(Emu_t *pEmu, uint8_t status, uint16_t wordOffset)
+{
+	uint8_t resp[sizeof(sh_FrsWriteResp_t)];
+
+	resp[0] = SH_FRS_WRITE_RESPONSE;
+	resp[1] = status;
+	write16(&resp[2], wordOffset);
+	emu_enqueue(pEmu, resp, sizeof(resp), false, (uint32_t)emu_now(pEmu));
+}
+
+// Unsolicited notification that an FRS record was written or erased
+static void emu_frsChanged(Emu_t *pEmu, uint16_t recordId)
+{
+	uint8_t r[8];
+
+	memset(r, 0, sizeof(r));
+	write16(&r[1], recordId);
+	emu_commandResp(pEmu, SH_CR_FRS_CHANGE, 0, 0, r, sizeof(r));
+}
+
+static void emu_frsWrite(Emu_t *pEmu, const uint8_t *report)
+{
+	uint16_t dataLen = read16(&report[2]);
+	uint16_t recordId = read16(&report[4]);
+	emu_FrsRecord_t *rec = emu_findFrs(pEmu, recordId);
+
+	if (dataLen == 0) {
+		// Erase
+		if (rec != 0) rec->valid = false;
+		emu_frsWriteResp(pEmu, SH_FRS_WRITE_COMPLETED, 0);
+		emu_frsChanged(pEmu, recordId);
+		return;
+	}
+	if (dataLen > SHEMU_FRS_WORDS) {
+		emu_frsWriteResp(pEmu, SH_FRS_WRITE_BAD_LEN, 0);
+		return;
+	}
+
+	if (rec == 0) {
+		// Find a free slot
+		for (int n = 0; n < SHEMU_FRS_RECORDS; n++) {
+			if (!pEmu->frs[n].valid) {
+				rec = &pEmu->frs[n];
+				break;
+			}
+		}
+	}
+	if (rec == 0) {
+		emu_frsWriteResp(pEmu, SH_FRS_WRITE_DEVICE_ERR, 0);
+		return;
+	}
+
+	pEmu->frsWrite = rec;
+	pEmu->frsWriteRecordId = recordId;
+	pEmu->frsWriteLen = dataLen;
+	pEmu->frsWritten = 0;
+	emu_frsWriteResp(pEmu, SH_FRS_WRITE_READY, 0);
+}
+
+static void emu_frsWriteData(Emu_t *pEmu, const uint8_t *report)
+{
+	uint16_t offset = read16(&report[2]);
+
+	if (pEmu->frsWrite == 0) {
+		emu_frsWriteResp(pEmu, SH_FRS_WRITE_BAD_MODE, offset);
+		return;
+	}
+
+	for (int n = 0; (n < 2) && (offset + n < pEmu->frsWriteLen); n++) {
+		pEmu->frsWriteData[offset + n] = read32(&report[4 + 4*n]);
+		pEmu->frsWritten++;
+	}
+
+	if (pEmu->frsWritten < pEmu->frsWriteLen) {
+		emu_frsWriteResp(pEmu, SH_FRS_WRITE_OK, offset);
+		return;
+	}
+
+	// Record complete: commit it
+	emu_FrsRecord_t *rec = pEmu->frsWrite;
+	rec->valid = true;
+	rec->recordId = pEmu->frsWriteRecordId;
+	rec->len = pEmu->frsWriteLen;
+	memcpy(rec->data, pEmu->frsWriteData, rec->len * sizeof(uint32_t));
+	pEmu->frsWrite = 0;
+
+	emu_frsWriteResp(pEmu, SH_FRS_WRITE_COMPLETED, offset);
+	emu_frsChanged(pEmu, rec->recordId);
+}
+
+static void emu_frsRead(Emu_t *pEmu, const uint8_t *report)
+{
+	uint16_t offset = read16(&report[2]);
+	uint16_t recordId = read16(&report[4]);
+	uint16_t readLen = read16(&report[6]);
+	emu_FrsRecord_t *rec = emu_findFrs(pEmu, recordId);
+	uint8_t resp[sizeof(sh_FrsReadResp_t)];
+	uint32_t now = (uint32_t)emu_now(pEmu);
+	uint16_t end;
+
+	memset(resp, 0, sizeof(resp));
+	resp[0] = SH_FRS_READ_RESPONSE;
+	write16(&resp[12], recordId);
+
+	if (rec == 0) {
+		resp[1] = SH_FRS_READ_EMPTY;
+		emu_enqueue(pEmu, resp, sizeof(resp), false, now);
+		return;
+	}
+	if (offset >= rec->len) {
+		resp[1] = SH_FRS_READ_OUT_OF_RANGE;
+		emu_enqueue(pEmu, resp, sizeof(resp), false, now);
+		return;
+	}
+
+	end = rec->len;
+	if ((readLen != 0) && (offset + readLen < end)) {
+		end = offset + readLen;
+	}
+
+	while (offset < end) {
+		uint8_t words = (end - offset >= 2) ? 2 : 1;
+		uint8_t status = SH_FRS_READ_NO_ERROR;
+
+		if (offset + words >= end) {
+			if (end == rec->len) {
+				status = (readLen != 0) ? SH_FRS_READ_BOTH_COMPLETED : SH_FRS_READ_RECORD_COMPLETED;
+			}
+			else {
+				status = SH_FRS_READ_BLOCK_COMPLETED;
+			}
+		}
+
+		resp[1] = (words << 4) | status;
+		write16(&resp[2], offset);
+		write32(&resp[4], rec->data[offset]);
+		write32(&resp[8], (words == 2) ? rec->data[offset+1] : 0);
+		emu_enqueue(pEmu, resp, sizeof(resp), false, now);
+
+		offset += words;
+	}
+}
+
+static void emu_commandResp(Emu_t *pEmu, uint8_t command, uint8_t cmdSeq, uint8_t respSeq,
+                            const uint8_t *r, unsigned rLen)
+{
+	uint8_t resp[sizeof(sh_CommandResp_t)];
+
+	memset(resp, 0, sizeof(resp));
+	resp[0] = SH_COMMAND_RESPONSE;
+	resp[1] = pEmu->responseSeq++;
+	resp[2] = command;
+	resp[3] = cmdSeq;
+	resp[4] = respSeq;
+	memcpy(&resp[5], r, rLen);
+
+	emu_enqueue(pEmu, resp, sizeof(resp), false, (uint32_t)emu_now(pEmu));
+}
+
+static void emu_commandRequest(Emu_t *pEmu, const uint8_t *report)
+{
+	uint8_t seq = report[1];
+	uint8_t command = report[2];
+	const uint8_t *p = &report[3];
+	uint8_t r[11];
+
+	memset(r, 0, sizeof(r));
+
+	switch (command) {
+	case SH_CR_REPORT_ERRORS:
+		// Empty error queue: a single terminating record
+		r[0] = 255;   // severity
+		r[2] = 255;   // source
+		emu_commandResp(pEmu, command, seq, 0, r, sizeof(r));
+		break;
+
+	case SH_CR_COUNTS:
+		if (p[1] > SH_MAX_SENSOR_ID) break;
+		if (p[0] == SH_CR_COUNTS_GET) {
+			emu_Sensor_t *s = &pEmu->sensor[p[1]];
+			r[0] = p[1];
+			r[1] = 1;   // status
+			write32(&r[3], s->offered);
+			write32(&r[7], s->accepted);
+			emu_commandResp(pEmu, command, seq, 0, r, sizeof(r));
+			write32(&r[3], (s->config.reportInterval_uS != 0) ? s->offered : 0);
+			write32(&r[7], s->offered);
+			emu_commandResp(pEmu, command, seq, 1, r, sizeof(r));
+		}
+		else if (p[0] == SH_CR_COUNTS_CLEAR) {
+			pEmu->sensor[p[1]].offered = 0;
+			pEmu->sensor[p[1]].accepted = 0;
+		}
+		break;
+
+	case SH_CR_INITIALIZE:
+		r[0] = 0;      // status
+		r[1] = p[0];   // subsystem
+		emu_commandResp(pEmu, command, seq, 0, r, sizeof(r));
+		break;
+
+	case SH_CR_SAVE_DCD:
+	case SH_CR_CAL_CONFIG:
+		r[0] = 0;      // status
+		emu_commandResp(pEmu, command, seq, 0, r, sizeof(r));
+		break;
+
+	case SH_CR_TARE:
+	case SH_CR_RV_SYNC:
+	default:
+		// No response
+		break;
+	}
+}
+
+// --- DFU bootloader ----------------------------------------------------------
+
+static void emu_dfuWrite(Emu_t *pEmu, const uint8_t *pSend, unsigned sendLen)
+{
+	unsigned len;
+
+	pEmu->dfuAck = 'n';
+	if (sendLen < 3) return;
+
+	len = sendLen - 2;
+	if (emu_crc16(pSend, len) != (((uint16_t)pSend[len] << 8) | pSend[len+1])) {
+		return;
+	}
+
+	switch (pEmu->dfuState) {
+	case EMU_DFU_APP_LEN:
+		if (len != 4) return;
+		pEmu->dfuAppLen = read32be(pSend);
+		pEmu->dfuState = EMU_DFU_PACKET_LEN;
+		break;
+
+	case EMU_DFU_PACKET_LEN:
+		if ((len != 1) || (pSend[0] == 0)) return;
+		pEmu->dfuState = EMU_DFU_DATA;
+		break;
+
+	case EMU_DFU_DATA:
+		if (pEmu->dfuReceived + len > pEmu->dfuAppLen) return;
+		pEmu->dfuReceived += len;
+		pEmu->stats.dfuBytes += len;
+		pEmu->dfuBusyUntil_us = emu_now(pEmu) + pEmu->config.dfuProgram_us;
+		if (pEmu->dfuReceived == pEmu->dfuAppLen) {
+			pEmu->dfuDone = true;
+		}
+		break;
+	}
+
+	pEmu->dfuAck = 's';
+}
+
+static void emu_dfuRead(Emu_t *pEmu, uint8_t *pReceive, unsigned receiveLen)
+{
+	// The bootloader stretches the clock until the packet is programmed
+	uint64_t now = emu_now(pEmu);
+	if (pEmu->dfuBusyUntil_us > now) {
+		emu_spend(pEmu, pEmu->dfuBusyUntil_us - now);
+	}
+
+	memset(pReceive, 0, receiveLen);
+	pReceive[0] = pEmu->dfuAck;
+	pEmu->dfuAck = 0;
+
+	if (pEmu->dfuDone) {
+		// Image complete: bootloader starts the application
+		pEmu->dfuMode = false;
+		pEmu->dfuDone = false;
+		emu_appReset(pEmu);
+	}
+}
+
+static uint16_t emu_crc16(const uint8_t *data, unsigned len)
+{
+	uint16_t crc = 0xFFFF;
+
+	for (unsigned n = 0; n < len; n++) {
+		crc ^= (uint16_t)data[n] << 8;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+
+	return crc;
+}
@@ -0,0 +1,165 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file SensorHubEmu.h
+ * @brief Host-side SH-1 emulator implementing the shdev API.
+ *
+ * SensorHubEmu.c provides an implementation of the functions declared in
+ * SensorHubDev.h that does not talk to real hardware.  Instead, it emulates
+ * an SH-1 at the HID-over-I2C protocol level: HID descriptor reads,
+ * GET_REPORT/SET_REPORT on the command and data registers, FRS reads and
+ * writes, command/response reports, streamed sensor input reports and the
+ * BNO070 DFU bootloader.
+ *
+ * Link SensorHubEmu.c and SensorHubRec.c in place of the platform's shdev
+ * implementation to run and profile the driver on a host system.  Bus
+ * latency is modeled per transaction and per byte, either as simulated
+ * time (fast, repeatable) or as real elapsed time.  Sensor reports are
+ * generated, or replayed from a recording of a real hub.
+ */
+
+#ifndef SENSORHUB_EMU_H
+#define SENSORHUB_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Units the emulator provides.  Independent of MAX_SH_UNITS, so hubs
+// opened with sh_open() can be emulated with MAX_SH_UNITS at 0.
+#ifndef SHEMU_MAX_UNITS
+#define SHEMU_MAX_UNITS (8)
+#endif
+
+/**
+ * @brief Emulator configuration.
+ */
+typedef struct shemu_Config_s {
+	/** If true, bus and wait times elapse in wall-clock time.  Otherwise
+	 *  the emulator advances a simulated clock and never blocks. */
+	bool realTime;
+
+	/** Fixed cost of each shdev_i2c() transaction, or of a whole
+	 *  shdev_i2c_batch() job. [uS] */
+	uint32_t i2cOverhead_us;
+
+	/** Cost of each byte on the bus. [nS]  (22500 ~ 400kHz) */
+	uint32_t i2cByte_ns;
+
+	/** Time the hub takes to act on each output report before its
+	 *  responses can be read.  Requests queue up behind each other. [uS] */
+	uint32_t responseLatency_us;
+
+	/** Time the DFU bootloader takes to program each firmware packet.
+	 *  Reading the packet's ack waits for it to finish. [uS] */
+	uint32_t dfuProgram_us;
+
+	/** If true, an input report stays queued when the host reads less
+	 *  than all of it, as SHHID_SPLIT_INPUT_READ requires.  Otherwise
+	 *  the rest of it is lost. */
+	bool keepShortReads;
+
+	/** If not NULL, a recording made with SensorHubRec.c.  Its sensor
+	 *  reports are produced in place of generated ones, at their recorded
+	 *  intervals, from each reset on.  With realTime false they are
+	 *  replayed as fast as the host reads them. */
+	const char *replayPath;
+} shemu_Config_t;
+
+/**
+ * @brief Emulator counters.
+ */
+typedef struct shemu_Stats_s {
+	uint32_t transactions;      /**< @brief shdev_i2c() and shdev_i2c_batch() calls */
+	uint32_t bytesWritten;      /**< @brief [bytes] host to hub */
+	uint32_t bytesRead;         /**< @brief [bytes] hub to host */
+	uint64_t busTime_us;        /**< @brief [uS] time spent on the bus */
+	uint32_t reportsGenerated;  /**< @brief sensor input reports produced */
+	uint32_t reportsDropped;    /**< @brief sensor reports lost to hub FIFO overflow */
+	uint32_t responsesDropped;  /**< @brief non-sensor reports lost to overflow */
+	uint32_t dfuBytes;          /**< @brief [bytes] firmware received via DFU */
+} shemu_Stats_t;
+
+/**
+ * @brief Fill a configuration structure with default values.
+ *
+ * @param[out] config  Storage for the default configuration.
+ */
+void shemu_getDefaultConfig(shemu_Config_t *config);
+
+/**
+ * @brief Configure an emulated unit.
+ *
+ * Should be called before sh_init() for that unit.  Units that are
+ * never configured use the defaults.
+ *
+ * @param  unit    Which emulated SensorHub.
+ * @param  config  The new configuration.
+ * @return         SH_STATUS_SUCCESS or SH_STATUS_BAD_PARAM.
+ */
+int shemu_configure(unsigned unit, const shemu_Config_t *config);
+
+/**
+ * @brief Read the emulator counters for a unit.
+ *
+ * @param      unit   Which emulated SensorHub.
+ * @param[out] stats  Counter values.
+ * @return            SH_STATUS_SUCCESS or SH_STATUS_BAD_PARAM.
+ */
+int shemu_getStats(unsigned unit, shemu_Stats_t *stats);
+
+/**
+ * @brief Clear the emulator counters for a unit.
+ *
+ * @param  unit    Which emulated SensorHub.
+ * @return         SH_STATUS_SUCCESS or SH_STATUS_BAD_PARAM.
+ */
+int shemu_clearStats(unsigned unit);
+
+/**
+ * @brief Check whether a replayed recording has run out.
+ *
+ * Reports already produced may still be waiting to be read.
+ *
+ * @param  unit    Which emulated SensorHub.
+ * @return         true if all of the recording has been produced, or
+ *                 there is none.
+ */
+bool shemu_replayDone(unsigned unit);
+
+/**
+ * @brief Current emulator time for a unit.
+ *
+ * This is the time base used for INTN timestamps and report generation.
+ *
+ * @param  unit    Which emulated SensorHub.
+ * @return         Emulator time. [uS]
+ */
+uint64_t shemu_getTime_us(unsigned unit);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+#endif
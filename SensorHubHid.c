@@ -22,16 +22,68 @@
 #include "SensorHubDev.h"
 #include "sh_util.h"
 
-// #define DEBUG_PRINTS
-#ifdef DEBUG_PRINTS
-#include <stdio.h>
-#endif
-
 #define SH_DESC_V1_LEN 30
 #define SH_DESC_V1_BCD 0x0100
 
 #define RESET_WAIT_MS (200)
 
+// Largest report descriptor read at init.  Longer ones are parsed in part.
+#ifndef SHHID_MAX_REPORT_DESC_LEN
+#define SHHID_MAX_REPORT_DESC_LEN (1024)
+#endif
+
+// Most reports whose lengths are kept from the report descriptor.  Others
+// are treated as not described.
+#ifndef SHHID_MAX_DESCRIBED_REPORTS
+#define SHHID_MAX_DESCRIBED_REPORTS (80)
+#endif
+
+// Claim and release reportDesc, which hubs opened at the same time share.
+// The claim spins for as long as another hub takes to read its descriptor.
+#ifndef CLAIM_REPORT_DESC
+#if defined(__GNUC__)
+#define CLAIM_REPORT_DESC() while (__atomic_test_and_set(&reportDescBusy, __ATOMIC_ACQUIRE)) {}
+#define RELEASE_REPORT_DESC() __atomic_clear(&reportDescBusy, __ATOMIC_RELEASE)
+#else
+#error Define CLAIM_REPORT_DESC() and RELEASE_REPORT_DESC() for this compiler
+#endif
+#endif
+
+// States of an input report read started by shhid_inStart
+enum {
+	HID_RX_IDLE,
+	HID_RX_BUSY,
+	HID_RX_DONE
+};
+
+// Statements only compiled in with SH_DRIVER_STATS
+#if SH_DRIVER_STATS
+#define STATS(stmt) stmt
+#else
+#define STATS(stmt)
+#endif
+
+// Statements only compiled in with SHHID_TRACE_LEN
+#if SHHID_TRACE_LEN
+#define TRACE(stmt) stmt
+#else
+#define TRACE(stmt)
+#endif
+
+// Report types in the report length table
+enum {
+	HID_LEN_INPUT,
+	HID_LEN_OUTPUT,
+	HID_LEN_FEATURE
+};
+
+// Length of one report from the report descriptor
+typedef struct hid_ReportLen_s {
+	uint8_t type;  // HID_LEN_...
+	uint8_t id;
+	uint8_t len;   // including report id
+} hid_ReportLen_t;
+
 // --- Private Types -----------------------------------------------------------
 
 // SensorHub HID Registers
@@ -82,6 +134,36 @@ typedef struct hid_descriptor_s {
 typedef struct Hid_s {
 	unsigned unit;
 	void * dev;  // Pointer to platform-specific stuff
+
+	// From the HID descriptor
+	uint16_t outputRegister;
+	uint16_t commandRegister;
+	uint16_t dataRegister;
+	uint16_t maxInputLen;      // including 2 byte length field
+
+	// Input report read started by shhid_inStart
+	volatile uint8_t rxState;  // HID_RX_...
+	volatile sh_Status_t rxStatus;
+	uint32_t rxTimestamp;
+	uint8_t rxBuffer[SHHID_MAX_REPORT_LEN+2];
+	uint32_t rxStart_us;
+
+#if SH_DRIVER_STATS
+	sh_DriverStats_t stats;
+#endif
+
+#if SHHID_TRACE_LEN
+	// Ring of trace records, oldest at traceHead
+	uint8_t trace[SHHID_TRACE_LEN][SHHID_TRACE_REC_LEN];
+	unsigned traceHead;
+	unsigned traceCount;
+	uint16_t traceSeq;
+#endif
+
+	// From the report descriptor: length of each described report, sorted
+	// by type then id.
+	hid_ReportLen_t reportLen[SHHID_MAX_DESCRIBED_REPORTS];
+	uint8_t numReportLens;
 } Hid_t;
 
 // --- Forward Declarations ----------------------------------------------------
@@ -96,18 +178,51 @@ static sh_Status_t shhid_getReport(void * hid,
                                    uint8_t reportId,
                                    uint8_t *payload, uint16_t *payloadLen);
 
+static uint16_t shhid_buildSetReport(Hid_t *pHid, uint8_t *cmd,
+                                     uint8_t reportType, uint8_t reportId,
+                                     const uint8_t *payload, uint16_t payloadLen);
+static sh_Status_t shhid_i2cBatch(Hid_t *pHid, const shdev_I2cXfer_t *pXfers, unsigned numXfers);
+
+static sh_Status_t shhid_i2c(Hid_t *pHid,
+                             const uint8_t *pSend, unsigned sendLen,
+                             uint8_t *pReceive, unsigned receiveLen);
+#if SH_DRIVER_STATS
+static void shhid_countI2c(Hid_t *pHid, unsigned sendLen, unsigned receiveLen,
+                           uint32_t start_us, sh_Status_t status);
+static unsigned shhid_statsBin(uint32_t us);
+#endif
+#if SHHID_TRACE_LEN
+static void shhid_trace(Hid_t *pHid, uint8_t kind, sh_Status_t status,
+                        uint8_t reportId, const uint8_t *body, uint16_t reportLen);
+static void shhid_traceIn(Hid_t *pHid, const uint8_t *buffer, sh_Status_t status);
+static void shhid_traceSetReport(Hid_t *pHid, const uint8_t *cmd, uint16_t cmdLen,
+                                 sh_Status_t status);
+#endif
+static void shhid_inDone(void *cookie, sh_Status_t status);
+static sh_Status_t shhid_inWait(Hid_t *pHid);
+static sh_Status_t shhid_inCopy(const uint8_t *buffer, sh_HidReport_t *report, uint16_t *reportLen);
+
+static void shhid_readDescriptors(Hid_t *pHid);
+static void shhid_parseReportDesc(Hid_t *pHid, const uint8_t *desc, uint16_t descLen);
+static uint16_t shhid_reportLen(Hid_t *pHid, uint8_t reportType, uint8_t reportId);
+static hid_ReportLen_t * shhid_findReportLen(Hid_t *pHid, uint8_t type, uint8_t id, bool add);
+
 // --- Private data ------------------------------------------------------------
 
+#if MAX_SH_UNITS > 0
 // SensorHub_t objects to be returned via shhid_init
 Hid_t hid[MAX_SH_UNITS];
+#endif
+
+// Report descriptor, only needed while shhid_open parses it
+static uint8_t reportDesc[SHHID_MAX_REPORT_DESC_LEN];
+static volatile bool reportDescBusy;
 
 // --- Public API --------------------------------------------------------------
   
 void * shhid_init(int unit, void * dev)
 {
-	sh_HidReport_t inReport;
-	uint16_t bufLen = sizeof(inReport);
-  
+#if MAX_SH_UNITS > 0
 	// Validate unit
 	if ((unit < 0) || (unit >= MAX_SH_UNITS)) {
 		// no such unit
@@ -115,10 +230,38 @@ void * shhid_init(int unit, void * dev)
 	}
 
 	// Allocate a HID structure for this unit.
-	Hid_t * pHid = &hid[unit];
+	return shhid_open(&hid[unit], unit, dev);
+#else
+	return 0;
+#endif
+}
+
+size_t shhid_getSize(void)
+{
+	return sizeof(Hid_t);
+}
+
+void * shhid_open(void *pMem, int unit, void * dev)
+{
+	sh_HidReport_t inReport;
+	uint16_t bufLen = sizeof(inReport);
+
+	Hid_t * pHid = (Hid_t *)pMem;
 	pHid->unit = unit;
 	pHid->dev = dev;
 
+	// Defaults, until the descriptors say otherwise
+	pHid->outputRegister = SH_REGISTER_OUTPUT;
+	pHid->commandRegister = SH_REGISTER_COMMAND;
+	pHid->dataRegister = SH_REGISTER_DATA;
+	pHid->maxInputLen = SHHID_MAX_INPUT_REPORT_LEN+2;
+	pHid->numReportLens = 0;
+	pHid->rxState = HID_RX_IDLE;
+	STATS(memset(&pHid->stats, 0, sizeof(pHid->stats)));
+	TRACE(pHid->traceHead = 0);
+	TRACE(pHid->traceCount = 0);
+	TRACE(pHid->traceSeq = 0);
+
 	// Reset the device layer
 	shdev_reset(pHid->dev);
 
@@ -126,6 +269,8 @@ void * shhid_init(int unit, void * dev)
 	// to be read after reset.  Read it and discard it.
 	shhid_in(pHid, &inReport, &bufLen, RESET_WAIT_MS, 0);
 
+	shhid_readDescriptors(pHid);
+
 	return pHid;
 }
 
@@ -137,12 +282,23 @@ sh_Status_t shhid_out(void * hid, void *report, uint16_t reportLen)
 {
 	Hid_t * pHid = (Hid_t *)hid;
 	uint8_t buffer[SHHID_MAX_REPORT_LEN+4];
+	uint16_t describedLen = shhid_reportLen(pHid, HID_REPORT_TYPE_OUTPUT, ((uint8_t *)report)[0]);
 
-	write16(&buffer[0], SH_REGISTER_OUTPUT);
+	// Send no more than the report descriptor says the report holds
+	if ((describedLen != 0) && (describedLen < reportLen)) reportLen = describedLen;
+	if (reportLen > SHHID_MAX_REPORT_LEN) reportLen = SHHID_MAX_REPORT_LEN;
+
+	write16(&buffer[0], pHid->outputRegister);
 	write16(&buffer[2], reportLen + 2);
 	memcpy(&buffer[4], report, reportLen);
 
-	return shdev_i2c(pHid->dev, buffer, reportLen+4, 0, 0);
+	sh_Status_t rc = shhid_inWait(pHid);
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = shhid_i2c(pHid, buffer, reportLen+4, 0, 0);
+	}
+	TRACE(shhid_trace(pHid, SHHID_TRACE_OUT, rc, buffer[4], &buffer[5], reportLen));
+
+	return rc;
 }
 
 // Check INTN, then i2c read to get IN report
@@ -157,15 +313,22 @@ sh_Status_t shhid_in(void * hid, sh_HidReport_t *report, uint16_t *reportLen, ui
 	Hid_t * pHid = (Hid_t *)hid;
 	sh_Status_t rc = SH_STATUS_SUCCESS;
 	uint8_t buffer[SHHID_MAX_REPORT_LEN+2];
+
+	// A report already on its way comes first
+	if (pHid->rxState != HID_RX_IDLE) {
+		rc = shhid_inWait(pHid);
+		if (rc != SH_STATUS_SUCCESS) {
+			*reportLen = 0;
+			return rc;
+		}
+		return shhid_inFinish(hid, report, reportLen, timestamp);
+	}
   
 	// Check INTN
 	bool ready = (shdev_waitIntn(pHid->dev, wait_ms) == false);
 
 	if (!ready) {
 		// No data available
-#ifdef DEBUG_PRINTS
-		printf("shhid_in: not ready");
-#endif
 		*reportLen = 0;
 		return SH_STATUS_NO_DATA;
 	}
@@ -174,40 +337,160 @@ sh_Status_t shhid_in(void * hid, sh_HidReport_t *report, uint16_t *reportLen, ui
 			// Grab timestamp
 			*timestamp = shdev_getTimestamp_us(pHid->dev);
 		}
+		STATS(pHid->stats.intnLatency[shhid_statsBin(shdev_getTime_us(pHid->dev) -
+		                                             shdev_getTimestamp_us(pHid->dev))]++);
 		
-		// Read from I2C
-		rc = shdev_i2c(pHid->dev, NULL, 0, buffer, sizeof(buffer));
+		// Read from I2C.  In split mode, just the length field at first.
+		rc = shhid_i2c(pHid, NULL, 0, buffer,
+		               SHHID_SPLIT_INPUT_READ ? 2 : pHid->maxInputLen);
 
-		if (rc != SH_STATUS_SUCCESS) 
-                        return rc;
+		if (rc != SH_STATUS_SUCCESS) {
+			TRACE(shhid_traceIn(pHid, NULL, rc));
+			return rc;
+		}
 
-		// Set returned report length
+#if SHHID_SPLIT_INPUT_READ
+		// Check the length field before reading the rest
 		*reportLen = read16(buffer);
-    
+		if (*reportLen == 0) {
+			// Reset message, nothing more to read
+			TRACE(shhid_traceIn(pHid, buffer, SH_STATUS_HUB_RESET));
+			return SH_STATUS_HUB_RESET;
+		}
 		if ((*reportLen < 2) || (*reportLen > SHHID_MAX_INPUT_REPORT_LEN+2)) {
-			// Invalid length
-#ifdef DEBUG_PRINTS
-			printf("shhid_in: invalid len: %d", *reportLen);
-#endif
+			STATS(pHid->stats.badLengths++);
+			TRACE(shhid_traceIn(pHid, buffer, SH_STATUS_ERROR_I2C_IO));
 			return SH_STATUS_ERROR_I2C_IO;
 		}
 
-		// Set returned report (don't include len field.)
-		memcpy((void *)report, buffer+2, *reportLen-2);
-		*reportLen -= 2;
+		// Read the whole report, now that its length is known.  It
+		// arrives with the length field in front again.
+		if (*reportLen > 2) {
+			rc = shhid_i2c(pHid, NULL, 0, buffer, *reportLen);
+			if (rc != SH_STATUS_SUCCESS) {
+				TRACE(shhid_traceIn(pHid, NULL, rc));
+				return rc;
+			}
+
+			// A different length means a different report: only part of
+			// it, or more than it, was read.
+			if (read16(buffer) != *reportLen) {
+				STATS(pHid->stats.badLengths++);
+				TRACE(shhid_traceIn(pHid, NULL, SH_STATUS_ERROR_I2C_IO));
+				return SH_STATUS_ERROR_I2C_IO;
+			}
+		}
+#endif
+
+		rc = shhid_inCopy(buffer, report, reportLen);
+		TRACE(shhid_traceIn(pHid, buffer, rc));
+		if (rc != SH_STATUS_SUCCESS) {
+			STATS(if (rc != SH_STATUS_HUB_RESET) pHid->stats.badLengths++);
+			return rc;
+		}
 	}
 
-#ifdef DEBUG_PRINTS
-	printf("%-16s [0x%02x]:", "shhid_in", report->reportId);
-	for (int i = 0; i < *reportLen-1; i++) {
-		printf(" %02x", report->body[i]);
+	return rc;
+}
+
+// Starts an IN report read if INTN is asserted.  The report is collected
+// later with shhid_inFinish.
+sh_Status_t shhid_inStart(void * hid)
+{
+	Hid_t * pHid = (Hid_t *)hid;
+	sh_Status_t rc;
+
+	if (pHid->rxState != HID_RX_IDLE) {
+		return SH_STATUS_BUSY;
+	}
+
+	// Check INTN, without waiting
+	if (shdev_waitIntn(pHid->dev, 0) != false) {
+		return SH_STATUS_NO_DATA;
+	}
+
+	pHid->rxTimestamp = shdev_getTimestamp_us(pHid->dev);
+	pHid->rxState = HID_RX_BUSY;
+
+#if SHDEV_I2C_ASYNC
+	STATS(pHid->rxStart_us = shdev_getTime_us(pHid->dev));
+	STATS(pHid->stats.intnLatency[shhid_statsBin(pHid->rxStart_us - pHid->rxTimestamp)]++);
+	rc = shdev_i2c_async(pHid->dev, NULL, 0, pHid->rxBuffer, pHid->maxInputLen,
+	                     shhid_inDone, pHid);
+	if (rc != SH_STATUS_SUCCESS) {
+		pHid->rxState = HID_RX_IDLE;
 	}
-	printf("\n");
+#else
+	STATS(pHid->stats.intnLatency[shhid_statsBin(shdev_getTime_us(pHid->dev) - pHid->rxTimestamp)]++);
+	rc = shhid_i2c(pHid, NULL, 0, pHid->rxBuffer, pHid->maxInputLen);
+	shhid_inDone(pHid, rc);
+	rc = SH_STATUS_SUCCESS;
 #endif
 
 	return rc;
 }
 
+// Collects the IN report read by shhid_inStart, once the transfer is done.
+sh_Status_t shhid_inFinish(void * hid, sh_HidReport_t *report, uint16_t *reportLen,
+                           uint32_t *timestamp)
+{
+	Hid_t * pHid = (Hid_t *)hid;
+	sh_Status_t rc;
+
+	if (pHid->rxState == HID_RX_IDLE) {
+		*reportLen = 0;
+		return SH_STATUS_NO_DATA;
+	}
+	if (pHid->rxState == HID_RX_BUSY) {
+		return SH_STATUS_BUSY;
+	}
+
+	rc = pHid->rxStatus;
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = shhid_inCopy(pHid->rxBuffer, report, reportLen);
+		STATS(if ((rc != SH_STATUS_SUCCESS) && (rc != SH_STATUS_HUB_RESET)) pHid->stats.badLengths++);
+	}
+	if (timestamp != NULL) {
+		*timestamp = pHid->rxTimestamp;
+	}
+	TRACE(shhid_traceIn(pHid, (pHid->rxStatus == SH_STATUS_SUCCESS) ? pHid->rxBuffer : NULL, rc));
+
+	// Buffer is free once the report has been copied out
+	pHid->rxState = HID_RX_IDLE;
+
+	return rc;
+}
+
+// Driver statistics for this unit, or NULL if not built in
+sh_DriverStats_t * shhid_getStats(void * hid)
+{
+#if SH_DRIVER_STATS
+	return &((Hid_t *)hid)->stats;
+#else
+	return NULL;
+#endif
+}
+
+// Move the oldest trace records out to pBuf
+int shhid_readTrace(void * hid, uint8_t *pBuf, unsigned maxRecords)
+{
+#if SHHID_TRACE_LEN
+	Hid_t * pHid = (Hid_t *)hid;
+	unsigned n;
+
+	for (n = 0; (n < maxRecords) && (pHid->traceCount > 0); n++) {
+		memcpy(pBuf, pHid->trace[pHid->traceHead], SHHID_TRACE_REC_LEN);
+		pBuf += SHHID_TRACE_REC_LEN;
+		pHid->traceHead = (pHid->traceHead + 1) % SHHID_TRACE_LEN;
+		pHid->traceCount--;
+	}
+
+	return n;
+#else
+	return SH_STATUS_ERROR;
+#endif
+}
+
 // Performs HID over i2c SET_REPORT for OUT report, reportId should be in report[0]
 sh_Status_t shhid_setOutReport(void * hid, void *report, uint16_t reportLen)
 {
@@ -215,6 +498,42 @@ sh_Status_t shhid_setOutReport(void * hid, void *report, uint16_t reportLen)
 	return shhid_setReport(hid, HID_REPORT_TYPE_OUTPUT, r->reportId, r->body, reportLen-1);
 }
 
+// Performs HID over i2c SET_REPORT for numReports OUT reports of reportLen
+// bytes each, stored back to back.  Sent SHHID_MAX_BATCH at a time with
+// shdev_i2c_batch() when the platform has it.
+sh_Status_t shhid_setOutReports(void * hid, void *reports, uint16_t reportLen, unsigned numReports)
+{
+	Hid_t * pHid = (Hid_t *)hid;
+	uint8_t cmd[SHHID_MAX_BATCH][SHHID_MAX_REPORT_LEN+8];
+	shdev_I2cXfer_t xfer[SHHID_MAX_BATCH];
+	uint8_t *next = (uint8_t *)reports;
+	sh_Status_t rc = shhid_inWait(pHid);
+
+	while ((numReports > 0) && (rc == SH_STATUS_SUCCESS)) {
+		unsigned n;
+
+		for (n = 0; (n < SHHID_MAX_BATCH) && (n < numReports); n++) {
+			sh_HidReport_t * r = (sh_HidReport_t *)next;
+			xfer[n].pSend = cmd[n];
+			xfer[n].sendLen = shhid_buildSetReport(pHid, cmd[n], HID_REPORT_TYPE_OUTPUT,
+			                                       r->reportId, r->body, reportLen-1);
+			xfer[n].pReceive = NULL;
+			xfer[n].receiveLen = 0;
+			next += reportLen;
+		}
+
+		rc = shhid_i2cBatch(pHid, xfer, n);
+		numReports -= n;
+#if SHHID_TRACE_LEN
+		for (unsigned k = 0; k < n; k++) {
+			shhid_traceSetReport(pHid, xfer[k].pSend, xfer[k].sendLen, rc);
+		}
+#endif
+	}
+
+	return rc;
+}
+
 // Performs HID over i2c SET_REPORT for FEATURE report, reportId should be in report[0]
 sh_Status_t shhid_setFeatureReport(void * hid, void *report, uint16_t reportLen)
 {
@@ -254,19 +573,184 @@ static sh_Status_t shhid_setReport(void * hid, uint8_t reportType, uint8_t repor
                                    uint8_t *payload, uint16_t payloadLen)
 {
 	uint8_t cmd[SHHID_MAX_REPORT_LEN+8];
-	int ix;
 	Hid_t * pHid = (Hid_t *)hid;
+	uint16_t cmdLen = shhid_buildSetReport(pHid, cmd, reportType, reportId, payload, payloadLen);
+
+	sh_Status_t rc = shhid_inWait(pHid);
+	if (rc == SH_STATUS_SUCCESS) {
+		rc = shhid_i2c(pHid, cmd, cmdLen, NULL, 0);
+	}
+	TRACE(shhid_traceSetReport(pHid, cmd, cmdLen, rc));
+
+	return rc;
+}
+
+// shdev_i2c, counted in the driver statistics
+static sh_Status_t shhid_i2c(Hid_t *pHid,
+                             const uint8_t *pSend, unsigned sendLen,
+                             uint8_t *pReceive, unsigned receiveLen)
+{
+	STATS(uint32_t start_us = shdev_getTime_us(pHid->dev));
+	sh_Status_t rc = shdev_i2c(pHid->dev, pSend, sendLen, pReceive, receiveLen);
+	STATS(shhid_countI2c(pHid, sendLen, receiveLen, start_us, rc));
+
+	return rc;
+}
+
+#if SH_DRIVER_STATS
+static void shhid_countI2c(Hid_t *pHid, unsigned sendLen, unsigned receiveLen,
+                           uint32_t start_us, sh_Status_t status)
+{
+	pHid->stats.i2cTransactions++;
+	if (status != SH_STATUS_SUCCESS) pHid->stats.i2cErrors++;
+	pHid->stats.bytesOut += sendLen;
+	pHid->stats.bytesIn += receiveLen;
+	pHid->stats.i2cDuration[shhid_statsBin(shdev_getTime_us(pHid->dev) - start_us)]++;
+}
+
+// Histogram bin for a time: bin n covers [16<<n, 32<<n) uS
+static unsigned shhid_statsBin(uint32_t us)
+{
+	unsigned bin = 0;
+
+	us >>= 5;
+	while ((us != 0) && (bin < SH_STATS_BINS-1)) {
+		us >>= 1;
+		bin++;
+	}
+
+	return bin;
+}
+#endif
+
+#if SHHID_TRACE_LEN
+// Add a record to the trace, replacing the oldest if it is full.  reportLen
+// includes the report id and is 0 if the transfer carried no report.
+static void shhid_trace(Hid_t *pHid, uint8_t kind, sh_Status_t status,
+                        uint8_t reportId, const uint8_t *body, uint16_t reportLen)
+{
+	unsigned tail = (pHid->traceHead + pHid->traceCount) % SHHID_TRACE_LEN;
+	uint8_t *rec = pHid->trace[tail];
+	uint16_t copyLen = reportLen;
+
+	if (pHid->traceCount < SHHID_TRACE_LEN) {
+		pHid->traceCount++;
+	}
+	else {
+		pHid->traceHead = (pHid->traceHead + 1) % SHHID_TRACE_LEN;
+	}
+
+	if (copyLen > SHHID_MAX_REPORT_LEN) copyLen = SHHID_MAX_REPORT_LEN;
+
+	write32(&rec[0], shdev_getTime_us(pHid->dev));
+	write16(&rec[4], pHid->traceSeq++);
+	rec[6] = kind;
+	rec[7] = (uint8_t)status;
+	rec[8] = (reportLen > 0xFF) ? 0xFF : reportLen;
+	rec[9] = 0;
+	memset(&rec[SHHID_TRACE_HDR_LEN], 0, SHHID_MAX_REPORT_LEN);
+	if (copyLen > 0) {
+		rec[SHHID_TRACE_HDR_LEN] = reportId;
+		memcpy(&rec[SHHID_TRACE_HDR_LEN+1], body, copyLen-1);
+	}
+}
+
+// Trace a raw IN transfer: length field then report.  NULL if the read failed.
+static void shhid_traceIn(Hid_t *pHid, const uint8_t *buffer, sh_Status_t status)
+{
+	uint16_t len = (buffer != NULL) ? read16(buffer) : 0;
+
+	// Length field counts itself
+	len = (len > 2) ? len - 2 : 0;
+	shhid_trace(pHid, SHHID_TRACE_IN, status,
+	            (len > 0) ? buffer[2] : 0, (len > 0) ? buffer+3 : NULL, len);
+}
 
-#ifdef DEBUG_PRINTS
-	printf("%-16s [0x%02x]:", "shhid_setReport", reportId);
-	for (int n = 0; n < payloadLen; n++) {
-		printf(" %02x", payload[n]);
+// Trace a SET_REPORT command built by shhid_buildSetReport
+static void shhid_traceSetReport(Hid_t *pHid, const uint8_t *cmd, uint16_t cmdLen,
+                                 sh_Status_t status)
+{
+	uint8_t reportId = cmd[2] & 0x0F;
+	uint16_t ix = 4;
+
+	if (reportId == 0x0F) {
+		reportId = cmd[ix++];
 	}
-	printf("\n");
+
+	// Skip data register and length field
+	ix += 4;
+	shhid_trace(pHid, SHHID_TRACE_SET_REPORT | (cmd[2] & 0x30), status, reportId,
+	            &cmd[ix], cmdLen - ix + 1);
+}
+#endif
+
+// Completion of the read started by shhid_inStart.  May run in an ISR.
+static void shhid_inDone(void *cookie, sh_Status_t status)
+{
+	Hid_t * pHid = (Hid_t *)cookie;
+
+#if SHDEV_I2C_ASYNC
+	STATS(shhid_countI2c(pHid, 0, pHid->maxInputLen, pHid->rxStart_us, status));
 #endif
+	pHid->rxStatus = status;
+	pHid->rxState = HID_RX_DONE;
+}
+
+// Wait for a read started by shhid_inStart to finish, so that no other
+// transfer overlaps it.  Its report stays in rxBuffer for shhid_inFinish.
+static sh_Status_t shhid_inWait(Hid_t *pHid)
+{
+#if SHDEV_I2C_ASYNC
+	uint32_t start_us = shdev_getTime_us(pHid->dev);
+
+	while (pHid->rxState == HID_RX_BUSY) {
+		if (shdev_getTime_us(pHid->dev) - start_us > SHHID_ASYNC_WAIT_MS*1000u) {
+			return SH_STATUS_ERROR_I2C_IO;
+		}
+	}
+#endif
+
+	return SH_STATUS_SUCCESS;
+}
+
+// Check the length field of a raw IN transfer and copy out the report
+static sh_Status_t shhid_inCopy(const uint8_t *buffer, sh_HidReport_t *report, uint16_t *reportLen)
+{
+	// Set returned report length
+	*reportLen = read16(buffer);
+
+	// HID over I2C: a zero length report follows a device reset
+	if (*reportLen == 0) {
+		return SH_STATUS_HUB_RESET;
+	}
+
+	if ((*reportLen < 2) || (*reportLen > SHHID_MAX_INPUT_REPORT_LEN+2)) {
+		// Invalid length
+		return SH_STATUS_ERROR_I2C_IO;
+	}
+
+	// Set returned report (don't include len field.)
+	memcpy((void *)report, buffer+2, *reportLen-2);
+	*reportLen -= 2;
+
+	return SH_STATUS_SUCCESS;
+}
+
+// Fill cmd with a SET_REPORT command and its data.  Returns its length.
+static uint16_t shhid_buildSetReport(Hid_t *pHid, uint8_t *cmd,
+                                     uint8_t reportType, uint8_t reportId,
+                                     const uint8_t *payload, uint16_t payloadLen)
+{
+	int ix;
+	uint16_t describedLen = shhid_reportLen(pHid, reportType, reportId);
+
+	// Send no more than the report descriptor says the report holds
+	if ((describedLen != 0) && (describedLen - 1 < payloadLen)) payloadLen = describedLen - 1;
+	// The report, id included, fits SHHID_MAX_REPORT_LEN, so the command
+	// fits SHHID_MAX_REPORT_LEN+8 even with the 9 byte long-id header.
+	if (payloadLen > SHHID_MAX_REPORT_LEN-1) payloadLen = SHHID_MAX_REPORT_LEN-1;
 
-	cmd[0] = SH_REGISTER_COMMAND;
-	cmd[1] = 0;
+	write16(&cmd[0], pHid->commandRegister);
 
 	if (reportId < 0x0F) {
 		cmd[2] = reportType | reportId;
@@ -280,15 +764,43 @@ static sh_Status_t shhid_setReport(void * hid, uint8_t reportType, uint8_t repor
 		ix = 5;
 	}
 
-	cmd[ix++] = SH_REGISTER_DATA;
-	cmd[ix++] = 0;
+	write16(&cmd[ix], pHid->dataRegister);
+	ix += 2;
 	cmd[ix++] = payloadLen + 2;
 	cmd[ix++] = 0;
 
 	memcpy(&cmd[ix], payload, payloadLen);
 	ix += payloadLen;
 
-	return shdev_i2c(pHid->dev, cmd, ix, NULL, 0);
+	return ix;
+}
+
+// Several transfers as one bus job, if the platform supports it
+static sh_Status_t shhid_i2cBatch(Hid_t *pHid, const shdev_I2cXfer_t *pXfers, unsigned numXfers)
+{
+#if SHDEV_I2C_BATCH
+	STATS(uint32_t start_us = shdev_getTime_us(pHid->dev));
+	sh_Status_t rc = shdev_i2c_batch(pHid->dev, pXfers, numXfers);
+#if SH_DRIVER_STATS
+	unsigned sendLen = 0;
+	unsigned receiveLen = 0;
+	for (unsigned n = 0; n < numXfers; n++) {
+		sendLen += pXfers[n].sendLen;
+		receiveLen += pXfers[n].receiveLen;
+	}
+	shhid_countI2c(pHid, sendLen, receiveLen, start_us, rc);
+#endif
+	return rc;
+#else
+	sh_Status_t rc = SH_STATUS_SUCCESS;
+
+	for (unsigned n = 0; (n < numXfers) && (rc == SH_STATUS_SUCCESS); n++) {
+		rc = shhid_i2c(pHid, pXfers[n].pSend, pXfers[n].sendLen,
+		               pXfers[n].pReceive, pXfers[n].receiveLen);
+	}
+
+	return rc;
+#endif
 }
 
 static sh_Status_t shhid_getReport(void * hid, uint8_t reportType, uint8_t reportId,
@@ -299,10 +811,11 @@ static sh_Status_t shhid_getReport(void * hid, uint8_t reportType, uint8_t repor
 	Hid_t * pHid = (Hid_t *)hid;
 	sh_Status_t status;
 	uint8_t buffer[SHHID_MAX_REPORT_LEN+2];
+	uint16_t readLen = sizeof(buffer);
+	uint16_t describedLen = shhid_reportLen(pHid, reportType, reportId);
 	int copylen;
 
-	cmd[0] = SH_REGISTER_COMMAND;
-	cmd[1] = 0;
+	write16(&cmd[0], pHid->commandRegister);
 
 	if (reportId < 0x0F) {
 		cmd[2] = reportType | reportId;
@@ -316,25 +829,183 @@ static sh_Status_t shhid_getReport(void * hid, uint8_t reportType, uint8_t repor
 		ix = 5;
 	}
 
-	cmd[ix++] = SH_REGISTER_DATA;
-	cmd[ix++] = 0;
+	write16(&cmd[ix], pHid->dataRegister);
+	ix += 2;
+
+	// Response is length field and report body, without report id
+	if ((describedLen != 0) && (describedLen + 1 < readLen)) readLen = describedLen + 1;
 
-	status = shdev_i2c(pHid->dev, cmd, ix, buffer, sizeof(buffer));
+	status = shhid_inWait(pHid);
+	if (status == SH_STATUS_SUCCESS) {
+		status = shhid_i2c(pHid, cmd, ix, buffer, readLen);
+	}
 
-	if (status < 0) return status;
+	if (status < 0) {
+		TRACE(shhid_trace(pHid, SHHID_TRACE_GET_REPORT | reportType, status, reportId, NULL, 0));
+		return status;
+	}
 
 	copylen = read16(buffer)-2;
+	if (copylen < 0) copylen = 0;
+	if (copylen > readLen-2) copylen = readLen-2;
 	if (copylen > *payloadLen) copylen = *payloadLen;
 	memcpy(payload, buffer+2, copylen);
 	*payloadLen = copylen;
-  
-#ifdef DEBUG_PRINTS
-	printf("%-16s [0x%02x]:", "shhid_getReport", reportId);
-	for (uint16_t n = 0; n < *payloadLen; n++) {
-		printf(" %02x", payload[n]);
-	}
-	printf("\n");
-#endif
-  
+	TRACE(shhid_trace(pHid, SHHID_TRACE_GET_REPORT | reportType, status, reportId,
+	                  payload, copylen + 1));
+
 	return status;
 }
+
+// Read the HID and report descriptors and record what they say
+static void shhid_readDescriptors(Hid_t *pHid)
+{
+	uint8_t cmd[2];
+	uint8_t desc[SH_DESC_V1_LEN];
+	uint16_t descLen;
+
+	write16(cmd, SH_REGISTER_HID_DESCRIPTOR);
+	if (shhid_i2c(pHid, cmd, sizeof(cmd), desc, sizeof(desc)) != SH_STATUS_SUCCESS) return;
+	if ((read16(&desc[0]) != SH_DESC_V1_LEN) || (read16(&desc[2]) != SH_DESC_V1_BCD)) {
+		// Unrecognized HID descriptor, keep the defaults
+		return;
+	}
+
+	pHid->outputRegister = read16(&desc[12]);
+	pHid->commandRegister = read16(&desc[16]);
+	pHid->dataRegister = read16(&desc[18]);
+	pHid->maxInputLen = read16(&desc[10]);
+	if ((pHid->maxInputLen < 2) || (pHid->maxInputLen > SHHID_MAX_INPUT_REPORT_LEN+2)) {
+		pHid->maxInputLen = SHHID_MAX_INPUT_REPORT_LEN+2;
+	}
+
+	descLen = read16(&desc[4]);
+	if (descLen > sizeof(reportDesc)) descLen = sizeof(reportDesc);
+	write16(cmd, read16(&desc[6]));
+	CLAIM_REPORT_DESC();
+	if (shhid_i2c(pHid, cmd, sizeof(cmd), reportDesc, descLen) == SH_STATUS_SUCCESS) {
+		shhid_parseReportDesc(pHid, reportDesc, descLen);
+	}
+	RELEASE_REPORT_DESC();
+}
+
+// Walk the short items of a report descriptor, totalling the size of each
+// input, output and feature report.  Each main item is rounded up to whole
+// bytes, which can only overestimate reports built from sub-byte fields.
+static void shhid_parseReportDesc(Hid_t *pHid, const uint8_t *desc, uint16_t descLen)
+{
+	uint32_t reportSize = 0;
+	uint32_t reportCount = 0;
+	uint8_t reportId = 0;
+	uint16_t ix = 0;
+	int type;
+
+	while (ix < descLen) {
+		uint8_t prefix = desc[ix++];
+		uint8_t size = prefix & 0x03;
+		uint32_t value = 0;
+
+		if (prefix == 0xFE) {
+			// Long item: size, tag, data
+			if (ix >= descLen) break;
+			ix += 2 + desc[ix];
+			continue;
+		}
+
+		if (size == 3) size = 4;
+		if (ix + size > descLen) break;
+		for (int n = 0; n < size; n++) {
+			value |= (uint32_t)desc[ix+n] << (8*n);
+		}
+		ix += size;
+
+		switch (prefix & 0xFC) {
+		case 0x74:  // Report Size
+			reportSize = value;
+			continue;
+		case 0x94:  // Report Count
+			reportCount = value;
+			continue;
+		case 0x84:  // Report ID
+			reportId = value;
+			continue;
+		case 0x80:  // Input
+			type = HID_LEN_INPUT;
+			break;
+		case 0x90:  // Output
+			type = HID_LEN_OUTPUT;
+			break;
+		case 0xB0:  // Feature
+			type = HID_LEN_FEATURE;
+			break;
+		default:
+			continue;
+		}
+
+		// Add this item's bytes, counting the report id the first time
+		hid_ReportLen_t *pLen = shhid_findReportLen(pHid, type, reportId, true);
+		if (pLen == NULL) continue;
+		uint32_t len = (pLen->len == 0) ? 1 : pLen->len;
+		len += (reportSize * reportCount + 7) / 8;
+		pLen->len = (len > 255) ? 255 : len;
+	}
+}
+
+// Length of a report, including report id, or 0 if not described
+static uint16_t shhid_reportLen(Hid_t *pHid, uint8_t reportType, uint8_t reportId)
+{
+	hid_ReportLen_t *pLen;
+
+	switch (reportType) {
+	case HID_REPORT_TYPE_INPUT:
+		pLen = shhid_findReportLen(pHid, HID_LEN_INPUT, reportId, false);
+		break;
+	case HID_REPORT_TYPE_OUTPUT:
+		pLen = shhid_findReportLen(pHid, HID_LEN_OUTPUT, reportId, false);
+		break;
+	case HID_REPORT_TYPE_FEATURE:
+		pLen = shhid_findReportLen(pHid, HID_LEN_FEATURE, reportId, false);
+		break;
+	default:
+		pLen = NULL;
+		break;
+	}
+
+	return (pLen != NULL) ? pLen->len : 0;
+}
+
+// Binary search of the report length table.  With add, a report not yet in
+// it is inserted with length 0, unless the table is full.
+static hid_ReportLen_t * shhid_findReportLen(Hid_t *pHid, uint8_t type, uint8_t id, bool add)
+{
+	unsigned key = (type << 8) | id;
+	unsigned lo = 0;
+	unsigned hi = pHid->numReportLens;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		unsigned midKey = (pHid->reportLen[mid].type << 8) | pHid->reportLen[mid].id;
+
+		if (midKey == key) return &pHid->reportLen[mid];
+		if (midKey < key) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if (!add || (pHid->numReportLens >= SHHID_MAX_DESCRIBED_REPORTS)) {
+		return NULL;
+	}
+
+	// Insert at lo, keeping the table sorted
+	memmove(&pHid->reportLen[lo+1], &pHid->reportLen[lo],
+	        (pHid->numReportLens - lo) * sizeof(hid_ReportLen_t));
+	pHid->reportLen[lo].type = type;
+	pHid->reportLen[lo].id = id;
+	pHid->reportLen[lo].len = 0;
+	pHid->numReportLens++;
+
+	return &pHid->reportLen[lo];
+}
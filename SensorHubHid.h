@@ -20,6 +20,7 @@
 #define SENSORHUB_HID_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include "sh_types.h"
 
 #ifdef __cplusplus
@@ -31,6 +32,46 @@ extern "C" {
 #define SHHID_MAX_OUTPUT_REPORT_LEN 16
 #define SHHID_MAX_REPORT_LEN 16
 
+// Set to 1 to have shhid_in() read each input report's length first and then
+// only that many bytes, rather than always reading the maximum length.  Only
+// for hubs that keep an input report queued until it has been read in full.
+#ifndef SHHID_SPLIT_INPUT_READ
+#define SHHID_SPLIT_INPUT_READ (0)
+#endif
+
+// Longest wait, with SHDEV_I2C_ASYNC, for a read started by shhid_inStart()
+// to finish before another transfer.  Needs shdev_getTime_us().
+#ifndef SHHID_ASYNC_WAIT_MS
+#define SHHID_ASYNC_WAIT_MS (50)
+#endif
+
+// Most reports shhid_setOutReports() sends in one bus job.
+#ifndef SHHID_MAX_BATCH
+#define SHHID_MAX_BATCH (4)
+#endif
+
+// Records kept in each unit's trace of HID traffic, read out with
+// shhid_readTrace().  0 leaves tracing out.  Needs shdev_getTime_us().
+#ifndef SHHID_TRACE_LEN
+#define SHHID_TRACE_LEN (0)
+#endif
+
+// Trace records, as returned by shhid_readTrace().  Multi-byte fields are
+// little endian.  scripts/shtrace/shtrace.py decodes them.
+//   [0..3]  time [uS] from shdev_getTime_us()
+//   [4..5]  sequence number, counting every record made
+//   [6]     SHHID_TRACE_... kind, ORed with HID report type for SET/GET_REPORT
+//   [7]     sh_Status_t of the transfer
+//   [8]     report length, including report id
+//   [9]     reserved
+//   [10..]  the report, starting with its id, up to SHHID_MAX_REPORT_LEN bytes
+#define SHHID_TRACE_HDR_LEN (10)
+#define SHHID_TRACE_REC_LEN (SHHID_TRACE_HDR_LEN + SHHID_MAX_REPORT_LEN)
+#define SHHID_TRACE_IN (1)          // input report, shhid_in() or shhid_inFinish()
+#define SHHID_TRACE_OUT (2)         // output report, shhid_out()
+#define SHHID_TRACE_SET_REPORT (3)  // SET_REPORT command
+#define SHHID_TRACE_GET_REPORT (4)  // GET_REPORT command and response
+
 #ifdef ARDUINO
   // On Arduino, don't do packed structures
   #define __packed 
@@ -353,16 +394,48 @@ typedef struct sh_RvSyncReq_s {
 
 void * shhid_init(int unit, void * dev);
 
+// Size of the HID state shhid_open() places in caller memory
+size_t shhid_getSize(void);
+
+// As shhid_init(), but with the HID state in pMem (shhid_getSize() bytes,
+// aligned for any type) rather than in the unit's static storage.
+void * shhid_open(void *pMem, int unit, void * dev);
+
 // Performs HID over i2c OUT, reportId should be in report[0]
 sh_Status_t shhid_out(void * hid, void *report, uint16_t reportLen);
 
 // Performs HID over i2c IN, reportId will be returned in report[0]
+// If a read from shhid_inStart() is outstanding, returns that report.
 sh_Status_t shhid_in(void * hid, sh_HidReport_t *report, uint16_t *reportLen,
                      uint16_t wait_ms, uint32_t *timestamp);
 
+// Starts reading an IN report if INTN is asserted, without waiting for the
+// transfer.  SH_STATUS_NO_DATA if INTN is deasserted, SH_STATUS_BUSY if a
+// read is already in progress.
+sh_Status_t shhid_inStart(void * hid);
+
+// Collects the IN report started by shhid_inStart().  SH_STATUS_BUSY while
+// the transfer is in progress, SH_STATUS_NO_DATA if none was started.
+sh_Status_t shhid_inFinish(void * hid, sh_HidReport_t *report, uint16_t *reportLen,
+                           uint32_t *timestamp);
+
+// Driver statistics for this unit, or NULL unless built with SH_DRIVER_STATS.
+// The HID layer counts bus traffic; the SensorHub layer adds report counts.
+sh_DriverStats_t * shhid_getStats(void * hid);
+
+// Moves up to maxRecords of the oldest trace records for this unit into
+// pBuf, SHHID_TRACE_REC_LEN bytes each.  Returns the number moved, or
+// SH_STATUS_ERROR unless built with SHHID_TRACE_LEN.  When the trace is
+// full, new records replace the oldest, leaving a gap in sequence numbers.
+int shhid_readTrace(void * hid, uint8_t *pBuf, unsigned maxRecords);
+
 // Performs HID over i2c SET_REPORT for OUT report,
 sh_Status_t shhid_setOutReport(void * hid, void *report, uint16_t reportLen);
 
+// Performs HID over i2c SET_REPORT for several OUT reports of equal length,
+// stored back to back, batching the transfers where the platform allows.
+sh_Status_t shhid_setOutReports(void * hid, void *reports, uint16_t reportLen, unsigned numReports);
+
 // Performs HID over i2c SET_REPORT for FEATURE report,
 sh_Status_t shhid_setFeatureReport(void * hid, void *report, uint16_t reportLen);
 
@@ -0,0 +1,150 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <string.h>
+
+#include "SensorHubRec.h"
+
+#define SHREC_MAGIC "SHRC"
+#define SHREC_VERSION (1)
+#define SHREC_HEADER_LEN (8)
+
+// Longest LEB128 encoding of a 32-bit value
+#define SHREC_MAX_DELTA_LEN (5)
+
+// --- Public API --------------------------------------------------------------
+
+int shrec_create(shrec_File_t *pRec, const char *path)
+{
+	uint8_t header[SHREC_HEADER_LEN] = { 0 };
+
+	memset(pRec, 0, sizeof(*pRec));
+	pRec->f = fopen(path, "wb");
+	if (pRec->f == 0) return SH_STATUS_ERROR;
+
+	memcpy(header, SHREC_MAGIC, 4);
+	header[4] = SHREC_VERSION;
+	if (fwrite(header, sizeof(header), 1, pRec->f) != 1) {
+		shrec_close(pRec);
+		return SH_STATUS_ERROR;
+	}
+
+	return SH_STATUS_SUCCESS;
+}
+
+int shrec_write(shrec_File_t *pRec, const uint8_t *report, uint16_t reportLen, uint32_t timestamp)
+{
+	uint8_t entry[SHREC_MAX_DELTA_LEN + 1 + 0xFF];
+	uint32_t delta = timestamp - pRec->lastTimestamp;
+	unsigned len = 0;
+
+	if (pRec->f == 0) return SH_STATUS_ERROR;
+	if ((reportLen == 0) || (reportLen > 0xFF)) return SH_STATUS_BAD_PARAM;
+
+	do {
+		entry[len] = delta & 0x7F;
+		delta >>= 7;
+		if (delta != 0) entry[len] |= 0x80;
+		len++;
+	} while (delta != 0);
+	entry[len++] = (uint8_t)reportLen;
+	memcpy(&entry[len], report, reportLen);
+	len += reportLen;
+
+	// A failed write may leave part of the entry behind, so end the
+	// recording there rather than append misaligned entries.
+	if (fwrite(entry, len, 1, pRec->f) != 1) {
+		shrec_close(pRec);
+		return SH_STATUS_ERROR;
+	}
+
+	pRec->lastTimestamp = timestamp;
+	pRec->reports++;
+
+	return SH_STATUS_SUCCESS;
+}
+
+void shrec_record(void *sh, void *cookie, const uint8_t *report,
+                  uint16_t reportLen, uint32_t timestamp)
+{
+	shrec_write((shrec_File_t *)cookie, report, reportLen, timestamp);
+}
+
+int shrec_open(shrec_File_t *pRec, const char *path)
+{
+	uint8_t header[SHREC_HEADER_LEN];
+
+	memset(pRec, 0, sizeof(*pRec));
+	pRec->f = fopen(path, "rb");
+	if (pRec->f == 0) return SH_STATUS_ERROR;
+
+	if ((fread(header, sizeof(header), 1, pRec->f) != 1) ||
+	    (memcmp(header, SHREC_MAGIC, 4) != 0) ||
+	    (header[4] != SHREC_VERSION)) {
+		shrec_close(pRec);
+		return SH_STATUS_ERROR;
+	}
+
+	return SH_STATUS_SUCCESS;
+}
+
+int shrec_read(shrec_File_t *pRec, uint8_t *report, uint16_t *reportLen, uint32_t *timestamp)
+{
+	uint32_t delta = 0;
+	unsigned shift = 0;
+	int c;
+
+	if (pRec->f == 0) return SH_STATUS_ERROR;
+
+	// Time since the last report
+	do {
+		c = fgetc(pRec->f);
+		if (c == EOF) {
+			// A clean end only before the first byte of an entry
+			return (shift == 0) ? SH_STATUS_NO_DATA : SH_STATUS_ERROR;
+		}
+		if (shift >= 7 * SHREC_MAX_DELTA_LEN) return SH_STATUS_ERROR;
+		// The fifth byte holds just the top 4 bits of 32
+		if ((shift == 7 * (SHREC_MAX_DELTA_LEN-1)) && (c & 0x70)) return SH_STATUS_ERROR;
+		delta |= (uint32_t)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	c = fgetc(pRec->f);
+	if ((c == EOF) || (c == 0) || (c > *reportLen)) return SH_STATUS_ERROR;
+	if (fread(report, c, 1, pRec->f) != 1) return SH_STATUS_ERROR;
+
+	*reportLen = c;
+	pRec->lastTimestamp += delta;
+	*timestamp = pRec->lastTimestamp;
+	pRec->reports++;
+
+	return SH_STATUS_SUCCESS;
+}
+
+int shrec_close(shrec_File_t *pRec)
+{
+	int rc = SH_STATUS_SUCCESS;
+
+	if ((pRec->f != 0) && (fclose(pRec->f) != 0)) {
+		rc = SH_STATUS_ERROR;
+	}
+	pRec->f = 0;
+
+	return rc;
+}
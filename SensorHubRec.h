@@ -0,0 +1,131 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file SensorHubRec.h
+ * @brief Recordings of raw input reports (hosts with stdio).
+ *
+ * SensorHubRec.c writes the input reports read from a SensorHub, with
+ * their INTN timestamps, to a compact file, and reads them back.  Pass
+ * shrec_record() to sh_setReportTap() to make a recording.  The emulator
+ * in SensorHubEmu.c replays a recording through the whole driver when
+ * its replayPath is set.
+ *
+ * A recording is an 8 byte header, "SHRC", a version byte and three
+ * reserved bytes, followed by one entry per report:
+ *   - the time since the previous report's timestamp (since 0 for the
+ *     first), in uS, as an unsigned LEB128 number: 7 bits per byte, least
+ *     significant first, top bit set on all but the last byte;
+ *   - the report length, including report id, in one byte;
+ *   - the report, starting with its report id.
+ */
+
+#ifndef SENSORHUB_REC_H
+#define SENSORHUB_REC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sh_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief An open recording.
+ */
+typedef struct shrec_File_s {
+	FILE *f;
+	uint32_t lastTimestamp;   /**< @brief timestamp of the last report written or read */
+	uint32_t reports;         /**< @brief reports written or read so far */
+} shrec_File_t;
+
+/**
+ * @brief Create a recording, replacing any existing file.
+ *
+ * @param[out] pRec  Recording state.
+ * @param      path  File name.
+ * @return           SH_STATUS_SUCCESS or SH_STATUS_ERROR.
+ */
+int shrec_create(shrec_File_t *pRec, const char *path);
+
+/**
+ * @brief Add a report to a recording.
+ *
+ * After a write error the recording is closed, so that no entries follow
+ * a partly written one, and later calls return SH_STATUS_ERROR.
+ *
+ * @param  pRec       Recording made with shrec_create().
+ * @param  report     The report, starting with its report id.
+ * @param  reportLen  Length of the report, including report id.
+ * @param  timestamp  Time the report was ready. [uS]
+ * @return            SH_STATUS_SUCCESS, SH_STATUS_BAD_PARAM or SH_STATUS_ERROR.
+ */
+int shrec_write(shrec_File_t *pRec, const uint8_t *report, uint16_t reportLen, uint32_t timestamp);
+
+/**
+ * @brief sh_ReportCallback_t that adds each report to a recording.
+ *
+ * Use as sh_setReportTap(sh, shrec_record, pRec).  Write errors are
+ * ignored; the recording just ends early.
+ *
+ * @param  sh         The SensorHub the report came from.
+ * @param  cookie     The shrec_File_t made with shrec_create().
+ * @param  report     The report, starting with its report id.
+ * @param  reportLen  Length of the report, including report id.
+ * @param  timestamp  shdev_getTimestamp_us() value for the report. [uS]
+ */
+void shrec_record(void *sh, void *cookie, const uint8_t *report,
+                  uint16_t reportLen, uint32_t timestamp);
+
+/**
+ * @brief Open a recording to read it.
+ *
+ * @param[out] pRec  Recording state.
+ * @param      path  File name.
+ * @return           SH_STATUS_SUCCESS or SH_STATUS_ERROR if the file
+ *                   can't be read or isn't a recording.
+ */
+int shrec_open(shrec_File_t *pRec, const char *path);
+
+/**
+ * @brief Read the next report from a recording.
+ *
+ * @param         pRec       Recording opened with shrec_open().
+ * @param[out]    report     The report, starting with its report id.
+ * @param[in,out] reportLen  Size of report buffer.  Length of the report on return.
+ * @param[out]    timestamp  The report's timestamp. [uS]
+ * @return                   SH_STATUS_SUCCESS, SH_STATUS_NO_DATA at the end
+ *                           of the recording or SH_STATUS_ERROR if it's corrupt.
+ */
+int shrec_read(shrec_File_t *pRec, uint8_t *report, uint16_t *reportLen, uint32_t *timestamp);
+
+/**
+ * @brief Close a recording.
+ *
+ * @param  pRec  Recording from shrec_create() or shrec_open().
+ * @return       SH_STATUS_SUCCESS or SH_STATUS_ERROR if data couldn't be written.
+ */
+int shrec_close(shrec_File_t *pRec);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+#endif
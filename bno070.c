@@ -27,25 +27,96 @@
 
 #define MAX_PACKET_LEN (64)  // actual packets will have 2 byte CRC in addition to up to 64 bytes data
 
+// Phase timing needs shdev_getTime_us() from the platform.
+#ifdef BNO070_DFU_TIMING
+#define DFU_NOW(dev) shdev_getTime_us(dev)
+#else
+#define DFU_NOW(dev) (0)
+#endif
+
 static void write32be(uint8_t *buf, uint32_t value);
+static void append_crc(uint8_t *packet, uint8_t len);
+static int load_packet(const HcBin_t *hcbin, uint8_t *packet, uint32_t offset, uint8_t len);
 static int dfu_send(void * dev, uint8_t *packet, uint8_t len);
+static int dfu_write(void * dev, const uint8_t *packet, uint8_t len);
+static int dfu_ack(void * dev);
+
+// CRC-CCITT (polynomial 0x1021), one entry per value of the top byte
+static const uint16_t crcTable[256] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
+};
+
+#if MAX_SH_UNITS > 0
+// Results of the last DFU on each unit below MAX_SH_UNITS
+static bno070_DfuStats_t dfuStats[MAX_SH_UNITS];
+#endif
   
 int bno070_performDfu(int unit, const HcBin_t *hcbin)
 {
-	uint8_t packet[MAX_PACKET_LEN + 2];   // max data len + 2 byte CRC
+	uint8_t packet[2][MAX_PACKET_LEN + 2];   // max data len + 2 byte CRC, double buffered
 	uint32_t app_len = 0;
 	uint32_t packet_len = MAX_PACKET_LEN;
 	uint32_t offset = 0;
+	uint32_t toSend = 0;
+	uint32_t nextLen = 0;
+	int cur = 0;
 	int rc = 0;
+	bno070_DfuStats_t localStats;
+	bno070_DfuStats_t *stats = &localStats;
+	uint32_t start, t, now;
+
+	if (unit < 0) {
+		return SH_STATUS_BAD_PARAM;
+	}
+#if MAX_SH_UNITS > 0
+	if (unit < MAX_SH_UNITS) {
+		stats = &dfuStats[unit];
+	}
+#endif
+	memset(stats, 0, sizeof(*stats));
 
         void * dev = shdev_init(unit);
         if (dev == 0) {
-          // error!
-          while (1);
+          // No such unit on this platform
+          return SH_STATUS_BAD_PARAM;
         }
+	start = t = DFU_NOW(dev);
     
 	// Prepare the HcBin object for reading
-	hcbin->open();
+	if (hcbin->open() != 0) {
+		return SH_STATUS_INVALID_HCBIN;
+	}
 	
 	// Validity checks on HCBIN file
         const char * fwFormat = hcbin->getMeta("FW-Format");
@@ -68,23 +139,55 @@ int bno070_performDfu(int unit, const HcBin_t *hcbin)
 	}
 
 	// Send size of application code
-        write32be(packet, app_len);
-	rc = dfu_send(dev, packet, 4);
+        write32be(packet[0], app_len);
+	rc = dfu_send(dev, packet[0], 4);
 	if (rc < 0) goto error;
 	
 	// Send packet size
-        packet[0] = packet_len;
-	rc = dfu_send(dev, packet, 1);
+        packet[0][0] = packet_len;
+	rc = dfu_send(dev, packet[0], 1);
 	if (rc < 0) goto error;
-	
-	// Send data in packets of <packet-size>
-	for (offset = 0; offset < app_len; offset += packet_len) {
-		uint32_t toSend = min(app_len - offset, packet_len);
-		rc = hcbin->getAppData(packet, offset, toSend);
+
+	now = DFU_NOW(dev);
+	stats->reset_us = now - t;
+	t = now;
+
+	// Send data in packets of <packet-size>.  Packet N+1 is read and its CRC
+	// computed after packet N is written, while the device programs it.
+	toSend = min(app_len, packet_len);
+	if (toSend > 0) {
+		rc = load_packet(hcbin, packet[cur], 0, toSend);
 		if (rc < 0) goto error;
+	}
+	now = DFU_NOW(dev);
+	stats->prepare_us += now - t;
+	t = now;
+
+	for (offset = 0; offset < app_len; offset += toSend, toSend = nextLen) {
+		rc = dfu_write(dev, packet[cur], toSend);
+		if (rc < 0) goto error;
+		now = DFU_NOW(dev);
+		stats->transfer_us += now - t;
+		t = now;
+
+		nextLen = min(app_len - (offset + toSend), packet_len);
+		if (nextLen > 0) {
+			rc = load_packet(hcbin, packet[cur ^ 1], offset + toSend, nextLen);
+			if (rc < 0) goto error;
+		}
+		now = DFU_NOW(dev);
+		stats->prepare_us += now - t;
+		t = now;
 
-		rc = dfu_send(dev, packet, toSend);
+		rc = dfu_ack(dev);
 		if (rc < 0) goto error;
+		now = DFU_NOW(dev);
+		stats->ack_us += now - t;
+		t = now;
+
+		stats->appBytes += toSend;
+		stats->packets++;
+		cur ^= 1;
 	}
 
 	// We are done with the hcbin object
@@ -93,6 +196,13 @@ int bno070_performDfu(int unit, const HcBin_t *hcbin)
 	// BNO should watchdog reset, wait for INTN to be asserted
 	while (shdev_waitIntn(dev, SH_WAIT_FOREVER) != false);
 
+	now = DFU_NOW(dev);
+	stats->restart_us = now - t;
+	stats->total_us = now - start;
+	if (stats->total_us > 0) {
+		stats->bytesPerSec = (uint32_t)(((uint64_t)stats->appBytes * 1000000) / stats->total_us);
+	}
+
 	return rc;
 
  error:
@@ -101,6 +211,21 @@ int bno070_performDfu(int unit, const HcBin_t *hcbin)
 	return rc;
 }
 
+int bno070_getDfuStats(int unit, bno070_DfuStats_t *pStats)
+{
+#if MAX_SH_UNITS > 0
+	if ((unit < 0) || (unit >= MAX_SH_UNITS) || (pStats == 0)) {
+		return SH_STATUS_BAD_PARAM;
+	}
+
+	*pStats = dfuStats[unit];
+
+	return SH_STATUS_SUCCESS;
+#else
+	return SH_STATUS_BAD_PARAM;
+#endif
+}
+
 static void write32be(uint8_t *buf, uint32_t value)
 {
 	*buf++ = (value >> 24) & 0xFF;
@@ -112,21 +237,11 @@ static void write32be(uint8_t *buf, uint32_t value)
 static void append_crc(uint8_t *packet, uint8_t len)
 {
   uint16_t crc;
-  uint16_t x;
 
-  // compute CRC of packet
+  // compute CRC of packet, a byte at a time
   crc = 0xFFFF;
   for (int n = 0; n < len; n++) {
-    x = (uint16_t)(packet[n]) << 8;
-    for (int i = 0; i < 8; i++) {
-      if ((crc ^ x) & 0x8000) {
-        crc = (crc << 1) ^ 0x1021;
-      }
-      else {
-        crc = crc << 1;
-      }
-      x <<= 1;
-    }
+    crc = (crc << 8) ^ crcTable[(crc >> 8) ^ packet[n]];
   }
 
   // Append the CRC to packet
@@ -134,35 +249,79 @@ static void append_crc(uint8_t *packet, uint8_t len)
   packet[len+1] = crc & 0xFF;
 }
 
+// Fill packet with len bytes of firmware from offset and append the CRC.
+// Reads the image in place when the HcBin object allows it.
+static int load_packet(const HcBin_t *hcbin, uint8_t *packet, uint32_t offset, uint8_t len)
+{
+  const uint8_t *src = 0;
+  uint16_t crc;
+
+  if (hcbin->getAppDataPtr != 0) {
+    src = hcbin->getAppDataPtr(offset, len);
+  }
+  if (src == 0) {
+    if (hcbin->getAppData(packet, offset, len) != 0) {
+      return SH_STATUS_INVALID_HCBIN;
+    }
+    append_crc(packet, len);
+    return SH_STATUS_SUCCESS;
+  }
+
+  // Copy and compute the CRC in one pass
+  crc = 0xFFFF;
+  for (int n = 0; n < len; n++) {
+    packet[n] = src[n];
+    crc = (crc << 8) ^ crcTable[(crc >> 8) ^ src[n]];
+  }
+  packet[len] = (crc >> 8) & 0xFF;
+  packet[len+1] = crc & 0xFF;
+
+  return SH_STATUS_SUCCESS;
+}
+
+// Append CRC, send and wait for the ack
 static int dfu_send(void * dev, uint8_t *packet, uint8_t len)
 {
-  uint8_t ack_resp;
-  int rc = SH_STATUS_SUCCESS;
-  
-  // Append CRC to packet, then send to device.
+  int rc;
+
   append_crc(packet, len);
 
+  rc = dfu_write(dev, packet, len);
+  if (rc != SH_STATUS_SUCCESS) {
+    return rc;
+  }
+
+  return dfu_ack(dev);
+}
+
+// Send a packet whose CRC has already been appended
+static int dfu_write(void * dev, const uint8_t *packet, uint8_t len)
+{
+  int rc;
+
   // Send the packet to the device
   rc = shdev_i2c(dev, packet, len+2, 0, 0);
   if (rc != SH_STATUS_SUCCESS) {
-    rc = SH_STATUS_ERROR_I2C_IO;
-    goto error;
+    return SH_STATUS_ERROR_I2C_IO;
   }
 
+  return SH_STATUS_SUCCESS;
+}
+
+static int dfu_ack(void * dev)
+{
+  uint8_t ack_resp;
+  int rc;
+
   // Get ack.
   rc = shdev_i2c(dev, 0, 0, &ack_resp, 1);
   if (rc != SH_STATUS_SUCCESS) {
-    rc = SH_STATUS_ERROR_I2C_IO;
-    goto error;
+    return SH_STATUS_ERROR_I2C_IO;
   }
   if (ack_resp != 's') {
     // Got NACK
-    rc = SH_STATUS_NACK;
-    goto error;
+    return SH_STATUS_NACK;
   }
 
   return SH_STATUS_SUCCESS;
-
- error:
-  return rc;
 }
@@ -32,12 +32,41 @@ extern "C" {
  * Resets the BNO070 and performs the DFU process sending the firmware represented
  * by the hcbin parameter to the device.
  *
- * @param unit      Which BNO070 device to operate on.
+ * @param unit      Which BNO070 device to operate on, as passed to shdev_init().
  * @param hcbin     An object representing the firmware to be downloaded.
  * @return           SH_STATUS_SUCCESS or an error code.
  */	
 int bno070_performDfu(int unit, const HcBin_t *hcbin);
 
+/**
+ * @brief Measurements from a DFU operation.
+ *
+ * The time fields are only filled in when the driver is built with
+ * BNO070_DFU_TIMING defined, which requires shdev_getTime_us().
+ */
+typedef struct bno070_DfuStats_s {
+	uint32_t appBytes;     /**< @brief [bytes] firmware sent and acknowledged */
+	uint32_t packets;      /**< @brief firmware packets sent */
+	uint32_t reset_us;     /**< @brief [uS] DFU reset, length and packet size */
+	uint32_t prepare_us;   /**< @brief [uS] reading firmware and computing CRCs */
+	uint32_t transfer_us;  /**< @brief [uS] writing packets */
+	uint32_t ack_us;       /**< @brief [uS] waiting for packet acknowledgements */
+	uint32_t restart_us;   /**< @brief [uS] waiting for the new firmware to start */
+	uint32_t total_us;     /**< @brief [uS] whole operation */
+	uint32_t bytesPerSec;  /**< @brief appBytes / total_us, as bytes per second */
+} bno070_DfuStats_t;
+
+/**
+ * @brief Get measurements from the most recent DFU on a unit.
+ *
+ * Only kept for units below MAX_SH_UNITS.
+ *
+ * @param      unit    Which BNO070 device.
+ * @param[out] pStats  Measurements.  Cleared at the start of each bno070_performDfu().
+ * @return             SH_STATUS_SUCCESS or SH_STATUS_BAD_PARAM.
+ */
+int bno070_getDfuStats(int unit, bno070_DfuStats_t *pStats);
+
 #ifdef cplusplus
 };   // end of extern "C"
 #endif
@@ -44,6 +44,7 @@ part1 = """
 
 #include "HcBin.h"
 
+#include <stdbool.h>
 #include <string.h>
 
 #define ARRAY_LEN(a) ((sizeof(a))/(sizeof(a[0])))
@@ -55,6 +56,7 @@ static const char * hcbin_getMeta(const char * key);
 static uint32_t hcbin_getAppLen(void);
 static uint32_t hcbin_getPacketLen(void);
 static int hcbin_getAppData(uint8_t *packet, uint32_t offet, uint32_t len);
+static const uint8_t * hcbin_getAppDataPtr(uint32_t offset, uint32_t len);
 
 /* hcbin object to be used by DFU code */
 const HcBin_t bno070_firmware = {
@@ -63,7 +65,8 @@ const HcBin_t bno070_firmware = {
 	hcbin_getMeta,
 	hcbin_getAppLen,
 	hcbin_getPacketLen,
-	hcbin_getAppData
+	hcbin_getAppData,
+	hcbin_getAppDataPtr
 };
 
 /* ------------------------------------------------------------------------ */
@@ -131,17 +134,243 @@ static int hcbin_getAppData(uint8_t *packet, uint32_t offset, uint32_t len)
 
 	return 0;
 }
+
+static const uint8_t * hcbin_getAppDataPtr(uint32_t offset, uint32_t len)
+{
+	if ((offset+len) > ARRAY_LEN(hcbinFirmware)) {
+		/* requested data beyond the end */
+		return 0;
+	}
+
+	return &hcbinFirmware[offset];
+}
 """
 
+part2z = """
+/* ------------------------------------------------------------------------ */
+/* Decompressor */
+
+/*
+ * hcbinFirmware holds the application image in LZSS form.  It is a series
+ * of groups, each starting with a flag byte whose bits, LSB first, describe
+ * up to eight items.  A 1 bit is a literal: the next byte is copied to the
+ * output.  A 0 bit is a back-reference: the next two bytes, big endian,
+ * hold (distance-1) in the upper WINDOW_BITS and (length-MIN_MATCH) in the
+ * rest.  The decoder keeps the last WINDOW_LEN output bytes so
+ * hcbin_getAppData() can decompress incrementally as DFU asks for data.
+ */
+
+#define WINDOW_LEN (1 << HCBIN_WINDOW_BITS)
+#define LEN_BITS (16 - HCBIN_WINDOW_BITS)
+#define LEN_MASK ((1 << LEN_BITS) - 1)
+
+static struct {
+	uint32_t inPos;       /* next byte of hcbinFirmware to read */
+	uint32_t outPos;      /* offset of the next decompressed byte */
+	uint8_t flags;        /* remaining flag bits of the current group */
+	uint8_t flagBits;     /* number of flag bits left in flags */
+	uint16_t matchLen;    /* bytes left to copy from the window */
+	uint16_t matchDist;   /* distance back into the window */
+	uint16_t windowPos;   /* where the next output byte goes in window */
+	uint8_t window[WINDOW_LEN];
+} lz;
+
+static void lz_reset(void)
+{
+	lz.inPos = 0;
+	lz.outPos = 0;
+	lz.flags = 0;
+	lz.flagBits = 0;
+	lz.matchLen = 0;
+	lz.matchDist = 0;
+	lz.windowPos = 0;
+}
+
+static uint8_t lz_next(void)
+{
+	bool literal = false;
+	uint8_t c;
+
+	if (lz.matchLen == 0) {
+		if (lz.flagBits == 0) {
+			lz.flags = hcbinFirmware[lz.inPos++];
+			lz.flagBits = 8;
+		}
+		literal = (lz.flags & 1) != 0;
+		lz.flags >>= 1;
+		lz.flagBits--;
+
+		if (!literal) {
+			uint16_t code = (hcbinFirmware[lz.inPos] << 8) | hcbinFirmware[lz.inPos+1];
+			lz.inPos += 2;
+			lz.matchDist = (code >> LEN_BITS) + 1;
+			lz.matchLen = (code & LEN_MASK) + HCBIN_MIN_MATCH;
+		}
+	}
+
+	if (literal) {
+		c = hcbinFirmware[lz.inPos++];
+	} else {
+		c = lz.window[(lz.windowPos - lz.matchDist) & (WINDOW_LEN - 1)];
+		lz.matchLen--;
+	}
+
+	lz.window[lz.windowPos] = c;
+	lz.windowPos = (lz.windowPos + 1) & (WINDOW_LEN - 1);
+	lz.outPos++;
+	return c;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Private functions */
+
+static int hcbin_open(void)
+{
+	lz_reset();
+	return 0;
+}
+
+static int hcbin_close(void)
+{
+	/* Nothing to do */
+	return 0;
+}
+
+static const char * hcbin_getMeta(const char * key)
+{
+	for (int i = 0; i < ARRAY_LEN(hcbinMetadata); i++) {
+		if (strcmp(key, hcbinMetadata[i].key) == 0) {
+			/* Found key, return value */
+			return hcbinMetadata[i].value;
+		}
+	}
+
+	/* Not found */
+	return 0;
+}
+
+static uint32_t hcbin_getAppLen(void)
+{
+	return HCBIN_APP_LEN;
+}
+
+static uint32_t hcbin_getPacketLen(void)
+{
+	/* This implementation doesn't have a preferred packet len */
+	return 0;
+}
+
+static int hcbin_getAppData(uint8_t *packet, uint32_t offset, uint32_t len)
+{
+	uint32_t copied = 0;
+
+	if ((offset+len) > HCBIN_APP_LEN) {
+		/* requested data beyond the end */
+		return -1;
+	}
+
+	/* Data is normally requested in order.  Going backwards means
+	 * starting over from the beginning of the image. */
+	if (offset < lz.outPos) {
+		lz_reset();
+	}
+	while (lz.outPos < offset) {
+		lz_next();
+	}
+
+	while (copied < len) {
+		packet[copied++] = lz_next();
+	}
+
+	return 0;
+}
+
+static const uint8_t * hcbin_getAppDataPtr(uint32_t offset, uint32_t len)
+{
+	/* The image only exists in compressed form */
+	return 0;
+}
+"""
+
+def lzssCompress(data, windowBits, minMatch=3, maxChain=256):
+    """Compress data in the format decoded by part2z."""
+    windowLen = 1 << windowBits
+    lenBits = 16 - windowBits
+    maxMatch = minMatch + (1 << lenBits) - 1
+
+    out = bytearray()
+    group = bytearray()
+    flags = 0
+    nflags = 0
+    chains = {}
+
+    def insert(pos):
+        if pos + minMatch <= len(data):
+            chains.setdefault(bytes(data[pos:pos+minMatch]), []).append(pos)
+
+    pos = 0
+    while pos < len(data):
+        # Find the longest match in the window
+        bestLen = 0
+        bestDist = 0
+        candidates = chains.get(bytes(data[pos:pos+minMatch]), [])
+        limit = min(maxMatch, len(data) - pos)
+        for cand in reversed(candidates[-maxChain:]):
+            dist = pos - cand
+            if dist > windowLen:
+                break
+            n = minMatch
+            while n < limit and data[cand+n] == data[pos+n]:
+                n += 1
+            if n > bestLen:
+                bestLen = n
+                bestDist = dist
+                if n == limit:
+                    break
+
+        if bestLen >= minMatch:
+            code = ((bestDist - 1) << lenBits) | (bestLen - minMatch)
+            group.append(code >> 8)
+            group.append(code & 0xFF)
+            for i in range(bestLen):
+                insert(pos + i)
+            pos += bestLen
+        else:
+            flags |= (1 << nflags)
+            group.append(data[pos])
+            insert(pos)
+            pos += 1
+
+        nflags += 1
+        if nflags == 8:
+            out.append(flags)
+            out.extend(group)
+            group = bytearray()
+            flags = 0
+            nflags = 0
+
+    if nflags != 0:
+        out.append(flags)
+        out.extend(group)
+
+    return out
+
 class HcBinGen:
     MAX_COL = 16
 
+    WINDOW_BITS = 10
+    MIN_MATCH = 3
+
     def __init__(self):
         self.hcbin = None
+        self.compress = False
 
     def setData(self, hcbin):
         self.hcbin = hcbin
 
+    def setCompress(self, compress):
+        self.compress = compress
+
     def write(self, c_filename, h_filename):
         f = open(h_filename, "w")
         f.write(header)
@@ -150,8 +379,18 @@ class HcBinGen:
         f = open(c_filename, "w")
         f.write(part1)
         self.writeMetadata(f)
-        self.writeFirmware(f)
-        f.write(part2)
+        if self.compress:
+            firmware = self.hcbin.getFirmware()
+            packed = lzssCompress(bytearray(firmware), HcBinGen.WINDOW_BITS, HcBinGen.MIN_MATCH)
+            print("Compressed %d bytes to %d." % (len(firmware), len(packed)))
+            f.write("#define HCBIN_APP_LEN (%d)\n" % (len(firmware),))
+            f.write("#define HCBIN_WINDOW_BITS (%d)\n" % (HcBinGen.WINDOW_BITS,))
+            f.write("#define HCBIN_MIN_MATCH (%d)\n\n" % (HcBinGen.MIN_MATCH,))
+            self.writeFirmware(f, packed)
+            f.write(part2z)
+        else:
+            self.writeFirmware(f, self.hcbin.getFirmware())
+            f.write(part2)
         f.close()
 
 
@@ -161,10 +400,10 @@ class HcBinGen:
             f.write('    {"%s", "%s"},\n' % (entry[0], entry[1]))
         f.write("};\n\n")
 
-    def writeFirmware(self, f):
+    def writeFirmware(self, f, firmware):
         f.write("static const uint8_t hcbinFirmware[] = {\n")
         col = 0
-        for x in self.hcbin.getFirmware():
+        for x in firmware:
             if col == 0:
                 # indent
                 f.write("    ");
@@ -33,7 +33,7 @@ import re
 
 def usage():
     print("hcbin2c.py [options] <input file> <output file>")
-    print("  -z use compression [not yet supported]")
+    print("  -z compress the firmware image")
 
 def baseFilename(s):
     filenameRE = re.compile("(.*)(\.[^.]*)")
@@ -56,7 +56,7 @@ def main():
         usage()
         sys.exit(1)
 
-    compress = True
+    compress = False
     for o, a in opts:
         if o in ("-h", "--help"):
             usage()
@@ -81,6 +81,7 @@ def main():
 
     gen = HcBinGen()
     gen.setData(hcbin)
+    gen.setCompress(compress)
     gen.write(c_outfile, h_outfile)
 
 if __name__ == "__main__":
@@ -0,0 +1,178 @@
+#!/usr/bin/python
+
+# SensorHub HID trace decoder
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+#
+# shtrace.py
+#
+# This script prints the trace records read from the MCU driver with
+# sh_readTrace(), one line per record.  The records are taken from a
+# binary file, or from a text file of hex bytes (e.g. a UART log).
+#
+
+import sys, getopt, struct
+
+# Record layout, see SensorHubHid.h
+HDR_LEN = 10
+DEFAULT_REPORT_LEN = 16
+
+KINDS = {
+    1: "IN",
+    2: "OUT",
+    3: "SET_REPORT",
+    4: "GET_REPORT",
+}
+
+REPORT_TYPES = {
+    0x00: "",
+    0x10: ".input",
+    0x20: ".output",
+    0x30: ".feature",
+}
+
+STATUS = {
+    0: "ok",
+    -1: "ERROR",
+    -2: "BAD_PARAM",
+    -3: "SH_ERR",
+    -4: "BAD_REPORT",
+    -5: "ERROR_I2C_IO",
+    -6: "NO_DATA",
+    -7: "BUSY",
+    -8: "TIMEOUT",
+    -9: "HUB_RESET",
+}
+
+REPORTS = {
+    0x01: "Accelerometer",
+    0x02: "Gyroscope",
+    0x03: "MagField",
+    0x04: "LinearAccel",
+    0x05: "RotationVector",
+    0x06: "Gravity",
+    0x07: "UncalGyro",
+    0x08: "GameRV",
+    0x09: "GeomagRV",
+    0x0a: "Pressure",
+    0x0b: "AmbientLight",
+    0x0c: "Humidity",
+    0x0d: "Proximity",
+    0x0e: "Temperature",
+    0x0f: "UncalMagField",
+    0x10: "TapDetector",
+    0x11: "StepCounter",
+    0x12: "SignificantMotion",
+    0x13: "ActivityClassification",
+    0x14: "RawAccel",
+    0x15: "RawGyro",
+    0x16: "RawMag",
+    0x17: "SAR",
+    0x18: "StepDetector",
+    0x19: "ShakeDetector",
+    0x1a: "FlipDetector",
+    0x1b: "PickupDetector",
+    0x1c: "StabilityDetector",
+    0x1e: "PersonalActivityClassifier",
+    0x1f: "SleepDetector",
+    0x80: "ProductIdRequest",
+    0x81: "ProductIdResponse",
+    0x82: "FrsWriteRequest",
+    0x83: "FrsWriteDataRequest",
+    0x84: "FrsWriteResponse",
+    0x85: "FrsReadRequest",
+    0x86: "FrsReadResponse",
+    0x87: "CommandRequest",
+    0x88: "CommandResponse",
+}
+
+def usage():
+    print("shtrace.py [options] <trace file>")
+    print("  -x          trace file is text, hex bytes separated by white space")
+    print("  -r <len>    SHHID_MAX_REPORT_LEN the driver was built with (default 16)")
+
+def readRecords(filename, hexText, recLen):
+    if hexText:
+        with open(filename, "r") as f:
+            data = bytearray(int(tok, 16) for tok in f.read().split())
+    else:
+        with open(filename, "rb") as f:
+            data = bytearray(f.read())
+
+    if len(data) % recLen != 0:
+        print("Warning: %d trailing bytes ignored" % (len(data) % recLen))
+
+    for n in range(len(data) // recLen):
+        yield data[n*recLen:(n+1)*recLen]
+
+def decode(rec, reportLen):
+    (time_us, seq, kind, status, length) = struct.unpack("<IHBbB", bytes(rec[0:9]))
+    stored = min(length, reportLen)
+    report = rec[HDR_LEN:HDR_LEN+stored]
+
+    name = KINDS.get(kind & 0x0F, "kind%d" % (kind & 0x0F)) + REPORT_TYPES.get(kind & 0x30, "")
+    line = "%12.6f %5d  %-18s %-12s" % (time_us / 1e6, seq, name,
+                                         STATUS.get(status, "status%d" % status))
+    if length > 0:
+        line += " [0x%02x] %-22s len %3d:" % (report[0], REPORTS.get(report[0], ""), length)
+        line += "".join(" %02x" % b for b in report[1:])
+        if length > stored:
+            line += " ..."
+    return (seq, line)
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "hxr:", ["help", "hex", "report-len="])
+    except getopt.GetoptError as err:
+        print(err)
+        usage()
+        sys.exit(1)
+
+    hexText = False
+    reportLen = DEFAULT_REPORT_LEN
+    for o, a in opts:
+        if o in ("-h", "--help"):
+            usage()
+            sys.exit()
+        elif o in ("-x", "--hex"):
+            hexText = True
+        elif o in ("-r", "--report-len"):
+            reportLen = int(a, 0)
+        else:
+            assert False, "unhandled option"
+
+    if len(args) != 1:
+        print("Need to specify trace file")
+        usage()
+        sys.exit(1)
+
+    lastSeq = None
+    for rec in readRecords(args[0], hexText, HDR_LEN + reportLen):
+        (seq, line) = decode(rec, reportLen)
+
+        # Records overwritten before they were read out leave a gap
+        if lastSeq is not None:
+            lost = (seq - lastSeq - 1) & 0xFFFF
+            if lost != 0:
+                print("--- %d records lost ---" % lost)
+        lastSeq = seq
+
+        print(line)
+
+if __name__ == "__main__":
+    main()
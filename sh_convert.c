@@ -0,0 +1,167 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "sh_convert.h"
+
+// Define SH_NO_SIMD to force the portable scalar path.
+#if !defined(SH_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SH_CONVERT_SSE2
+#elif !defined(SH_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define SH_CONVERT_NEON
+#endif
+
+// Events are converted in blocks of this many samples
+#define BLOCK_LEN (4)
+
+// Output slots, in sh_FloatSamples_t order
+enum {
+	OUT_X, OUT_Y, OUT_Z, OUT_W, OUT_ACCURACY, OUT_BIAS_X, OUT_BIAS_Y, OUT_BIAS_Z,
+	NUM_OUTPUTS
+};
+
+// --- Private Types -----------------------------------------------------------
+
+// How a sensor's 16-bit fields map to outputs.  Field n goes to out[n].
+// Fields from q2Start onward use qPoint2, the rest use qPoint1.
+typedef struct sh_ConvertMap_s {
+	uint8_t fields;
+	uint8_t q2Start;
+	uint8_t out[6];
+} sh_ConvertMap_t;
+
+// --- Private Data ------------------------------------------------------------
+
+static const sh_ConvertMap_t vector3Map = {
+	3, 3, { OUT_X, OUT_Y, OUT_Z }
+};
+static const sh_ConvertMap_t uncalMap = {
+	6, 3, { OUT_X, OUT_Y, OUT_Z, OUT_BIAS_X, OUT_BIAS_Y, OUT_BIAS_Z }
+};
+static const sh_ConvertMap_t quatMap = {
+	4, 4, { OUT_X, OUT_Y, OUT_Z, OUT_W }
+};
+static const sh_ConvertMap_t quatAccMap = {
+	5, 4, { OUT_X, OUT_Y, OUT_Z, OUT_W, OUT_ACCURACY }
+};
+
+// --- Private methods ---------------------------------------------------------
+
+static const sh_ConvertMap_t * getMap(sh_SensorId_t sensorId)
+{
+	switch (sensorId) {
+	case SH_ACCELEROMETER:
+	case SH_LINEAR_ACCELERATION:
+	case SH_GRAVITY:
+	case SH_GYROSCOPE_CALIBRATED:
+	case SH_MAGNETIC_FIELD_CALIBRATED:
+		return &vector3Map;
+	case SH_GYROSCOPE_UNCALIBRATED:
+	case SH_MAGNETIC_FIELD_UNCALIBRATED:
+		return &uncalMap;
+	case SH_GAME_ROTATION_VECTOR:
+		return &quatMap;
+	case SH_ROTATION_VECTOR:
+	case SH_GEOMAGNETIC_ROTATION_VECTOR:
+		return &quatAccMap;
+	default:
+		return 0;
+	}
+}
+
+static float qScale(uint16_t qPoint)
+{
+	if (qPoint > 31) qPoint = 31;
+	return 1.0f / (float)((uint32_t)1 << qPoint);
+}
+
+// Scale len (<= BLOCK_LEN) staged values into dst
+static void scaleBlock(float *dst, const int32_t *src, unsigned len, float scale)
+{
+#if defined(SH_CONVERT_SSE2)
+	if (len == BLOCK_LEN) {
+		__m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)src));
+		_mm_storeu_ps(dst, _mm_mul_ps(v, _mm_set1_ps(scale)));
+		return;
+	}
+#elif defined(SH_CONVERT_NEON)
+	if (len == BLOCK_LEN) {
+		float32x4_t v = vcvtq_f32_s32(vld1q_s32(src));
+		vst1q_f32(dst, vmulq_n_f32(v, scale));
+		return;
+	}
+#endif
+	for (unsigned n = 0; n < len; n++) {
+		dst[n] = (float)src[n] * scale;
+	}
+}
+
+// --- Public API --------------------------------------------------------------
+
+int sh_convertEvents(const sh_SensorEvent_t *pEvents, uint16_t numEvents,
+                     sh_SensorId_t sensorId,
+                     const sh_SensorMetadata_t *pMetadata,
+                     sh_FloatSamples_t *pOut)
+{
+	const sh_ConvertMap_t *map = getMap(sensorId);
+	int32_t stage[6][BLOCK_LEN];
+	float scale[6];
+	float *dst[6];
+	unsigned staged = 0;
+	int written = 0;
+
+	if ((map == 0) || (pMetadata == 0) || (pOut == 0)) return SH_STATUS_BAD_PARAM;
+	if ((pEvents == 0) && (numEvents > 0)) return SH_STATUS_BAD_PARAM;
+
+	// Resolve destination and scale for each field
+	float *outputs[NUM_OUTPUTS] = {
+		pOut->x, pOut->y, pOut->z, pOut->w, pOut->accuracy,
+		pOut->biasX, pOut->biasY, pOut->biasZ,
+	};
+	for (unsigned f = 0; f < map->fields; f++) {
+		dst[f] = outputs[map->out[f]];
+		scale[f] = qScale((f < map->q2Start) ? pMetadata->qPoint1 : pMetadata->qPoint2);
+	}
+
+	for (uint16_t n = 0; n < numEvents; n++) {
+		if (pEvents[n].sensor != sensorId) continue;
+
+		// Gather one block of samples, transposing to one row per field
+		for (unsigned f = 0; f < map->fields; f++) {
+			stage[f][staged] = (int16_t)pEvents[n].un.field16[f];
+		}
+		staged++;
+
+		if (staged == BLOCK_LEN) {
+			for (unsigned f = 0; f < map->fields; f++) {
+				if (dst[f] != 0) scaleBlock(&dst[f][written], stage[f], BLOCK_LEN, scale[f]);
+			}
+			written += BLOCK_LEN;
+			staged = 0;
+		}
+	}
+
+	// Partial final block
+	for (unsigned f = 0; f < map->fields; f++) {
+		if (dst[f] != 0) scaleBlock(&dst[f][written], stage[f], staged, scale[f]);
+	}
+	written += staged;
+
+	return written;
+}
@@ -0,0 +1,86 @@
+/* SH-1 MCU Driver - library for communicating with BNO070
+*
+* Copyright 2015-16 Hillcrest Laboratories, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License and
+* any applicable agreements you may have with Hillcrest Laboratories, Inc.
+* You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * @file sh_convert.h
+ * @brief Bulk conversion of fixed point sensor events to floating point.
+ *
+ * Sensor events carry their values as 16-bit fixed point numbers whose
+ * Q points are given by the sensor's metadata (see sh_getMetadata()).
+ * sh_convertEvents() converts a whole array of events at once into
+ * separate float arrays per component, using SSE2 or NEON when the
+ * target supports them.
+ */
+
+#ifndef SH_CONVERT_H
+#define SH_CONVERT_H
+
+#include <stdint.h>
+#include "sh_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Destination arrays for sh_convertEvents().
+ *
+ * Each pointer may be NULL if that component is not wanted.  Non-NULL
+ * arrays must hold as many floats as there are events to convert.
+ *
+ * For 3-axis sensors x, y and z are the axes.  For rotation vectors x, y,
+ * z and w are the i, j, k and real quaternion components.  Uncalibrated
+ * sensors put their bias estimates in biasX, biasY and biasZ.
+ */
+typedef struct sh_FloatSamples_s {
+	float *x;         /**< @brief X axis or quaternion i */
+	float *y;         /**< @brief Y axis or quaternion j */
+	float *z;         /**< @brief Z axis or quaternion k */
+	float *w;         /**< @brief Quaternion real part */
+	float *accuracy;  /**< @brief Rotation vector accuracy estimate [radians] */
+	float *biasX;     /**< @brief Uncalibrated sensor bias, X axis */
+	float *biasY;     /**< @brief Uncalibrated sensor bias, Y axis */
+	float *biasZ;     /**< @brief Uncalibrated sensor bias, Z axis */
+} sh_FloatSamples_t;
+
+/**
+ * @brief Convert an array of sensor events to floating point.
+ *
+ * Events from sensorId are converted, in order, using the Q points in
+ * pMetadata.  Events from other sensors are skipped, so the output arrays
+ * are densely packed.  Supported sensors are the calibrated 3-axis
+ * sensors, uncalibrated gyroscope and magnetic field, and the three
+ * rotation vectors.
+ *
+ * @param      pEvents    Array of events, as returned by sh_getEvents().
+ * @param      numEvents  Number of events in pEvents.
+ * @param      sensorId   Which sensor's events to convert.
+ * @param      pMetadata  Metadata for sensorId, supplying qPoint1 and qPoint2.
+ * @param[out] pOut       Destination arrays.
+ * @return                Number of samples written to each array or some failure code.
+ */
+int sh_convertEvents(const sh_SensorEvent_t *pEvents, uint16_t numEvents,
+                     sh_SensorId_t sensorId,
+                     const sh_SensorMetadata_t *pMetadata,
+                     sh_FloatSamples_t *pOut);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+#endif
@@ -101,6 +101,15 @@ enum sh_Status_e {
 
 	/** Attempt to read IN report when none available */
 	SH_STATUS_NO_DATA = -6,
+
+	/** No room for another outstanding command */
+	SH_STATUS_BUSY = -7,
+
+	/** No response to a command within SH_COMMAND_TIMEOUT_MS */
+	SH_STATUS_TIMEOUT = -8,
+
+	/** The SH-1 reset: outstanding requests were abandoned */
+	SH_STATUS_HUB_RESET = -9,
 	
 	/** received an out of order FRS read response */
 	SH_STATUS_FRS_READ_BAD_OFFSET = -100,      
@@ -374,6 +383,13 @@ typedef struct sh_SensorEvent {
 	 */
 	uint8_t sequenceNumber;
 
+	/** @brief Reports from this sensor missing just before this one.
+	 *
+	 * Worked out by the driver from the gap in sequence numbers since the
+	 * previous report from the sensor.  0 for the first report.
+	 */
+	uint8_t missed;
+
 	/** @brief 64-bit microsecond timestamp
 	 * 
 	 */
@@ -497,6 +513,48 @@ typedef struct sh_Counts {
 	uint32_t attempted; /**< @brief [events] */
 } sh_Counts_t;
 
+/**
+ * @brief Driver's count of a sensor's reports, from sequence numbers.
+ *
+ * Sequence numbers are 8 bits, so a run of 256 or more missing reports
+ * is undercounted by a multiple of 256.
+ */
+typedef struct sh_DeliveryCounts_s {
+	uint32_t delivered;  /**< @brief [reports] read from the hub */
+	uint32_t dropped;    /**< @brief [reports] missing from the sequence */
+	uint32_t gaps;       /**< @brief runs of one or more missing reports */
+	uint32_t wraps;      /**< @brief times the sequence number wrapped */
+	uint32_t duplicates; /**< @brief [reports] repeating the previous sequence number */
+} sh_DeliveryCounts_t;
+
+/**
+ * @brief Number of bins in each sh_DriverStats_t histogram.
+ *
+ * Bin 0 counts times under 32 uS.  Bin n counts times from 16<<n up to
+ * 32<<n uS, except the last, which has no upper limit.
+ */
+#define SH_STATS_BINS (12)
+
+/**
+ * @brief Driver Statistics
+ *
+ * Collected by the driver itself, when built with SH_DRIVER_STATS.
+ * See sh_getDriverStats().
+ */
+typedef struct sh_DriverStats {
+	uint32_t i2cTransactions;  /**< @brief bus jobs: shdev_i2c() and similar calls */
+	uint32_t i2cErrors;        /**< @brief bus jobs that failed */
+	uint32_t bytesOut;         /**< @brief [bytes] host to hub, including register numbers */
+	uint32_t bytesIn;          /**< @brief [bytes] hub to host */
+	uint32_t badLengths;       /**< @brief input reports with an invalid length field */
+	uint32_t decodeFailures;   /**< @brief sensor reports that could not be decoded */
+	uint32_t sensorReports[SH_MAX_SENSOR_ID+1];  /**< @brief input reports, by sensor id */
+	uint32_t controlReports[16];   /**< @brief input reports 0x80 to 0x8F, by id-0x80 */
+	uint32_t otherReports;     /**< @brief input reports with any other id */
+	uint32_t intnLatency[SH_STATS_BINS];  /**< @brief INTN assertion to start of read */
+	uint32_t i2cDuration[SH_STATS_BINS];  /**< @brief duration of each bus job */
+} sh_DriverStats_t;
+
 /**
  * @brief Bit Fields for specifying tare axes.
  *